@@ -1,6 +1,9 @@
 #include "message.h"
 #include "cache.h"
 #include "utility.h"
+#include "store.h"
+#include "prefetch.h"
+#include "sizer.h"
 
 
 #include <stdlib.h>
@@ -9,10 +12,41 @@
 #include <limits.h>
 #include <time.h>
 #include <stdbool.h>
+#include <pthread.h>
 
 extern int cache_count;
 extern t_lru_cache lru_cache;
 
+static int cache_capacity = CACHE_SIZE; // messages kept before one is replaced
+
+// Guards the cache structures while the background evictor shares them
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t evictor_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t evictor_thread;
+static bool evictor_running = false;
+static bool evictor_stop = false;
+static int evictor_low = 0; // free slots below which the evictor wakes up
+static int evictor_high = 0; // free slots it restores before sleeping again
+static t_cache_hash_entry** evictor_table = NULL;
+static int evictor_table_size = 0;
+static t_lru_cache* evictor_lru = NULL;
+static int* evictor_count = NULL;
+static int evictor_strategy = 0;
+static unsigned int evictor_seed = 1;
+static t_evictor_stats evictor_stats;
+
+// Entries (with their LRU node still attached) freed ahead of time by the evictor
+static t_cache_hash_entry* spare_entries = NULL;
+static int spare_count = 0;
+
+/**
+ * Maps a key to its hash bucket. The key is taken as unsigned, so a negative
+ * id still lands inside the table.
+ */
+static int hash_bucket(int key, int hash_table_size) {
+    return (int)((unsigned int)key % (unsigned int)hash_table_size);
+}
+
 /**
  * Adds a node to the head of the LRU cache.
  * 
@@ -82,7 +116,7 @@ int lru_replacement(t_cache_hash_entry *cache_hash_table[], int hash_table_size,
     int replaced_key = lru_node->key;
 
     // Remove the last node from the LRU cache
-    int hash_index = replaced_key % hash_table_size;
+    int hash_index = hash_bucket(replaced_key, hash_table_size);
     t_cache_hash_entry *current = cache_hash_table[hash_index];
     t_cache_hash_entry *prev = NULL;
     bool found = false;
@@ -178,6 +212,72 @@ int random_replacement(t_cache_hash_entry *cache_hash_table[], int hash_table_si
 }
 
 
+/**
+ * Returns how many messages the cache holds before it starts replacing them.
+ */
+int cache_get_capacity(void) {
+    return cache_capacity;
+}
+
+
+/**
+ * Changes the capacity with cache_lock held, replacing entries right away if it shrinks.
+ */
+static void resize_locked(int capacity, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy) {
+    if (capacity < 1 || capacity == cache_capacity) return;
+    printf("Cache capacity changed from %d to %d.\n", cache_capacity, capacity);
+    cache_capacity = capacity;
+    while (*cache_count > cache_capacity) {
+        int replaced = rep_strategy == 1
+            ? random_replacement(cache_hash_table, hash_table_size, lru_cache, cache_count)
+            : lru_replacement(cache_hash_table, hash_table_size, lru_cache, cache_count);
+        if (replaced < 0) break;
+    }
+}
+
+
+/**
+ * Change the cache capacity, replacing entries right away if it shrinks.
+ * 
+ * @param capacity The new capacity, at least 1.
+ * @param cache_hash_table Array of pointers to cache hash table entries.
+ * @param hash_table_size Size of the hash table.
+ * @param lru_cache Pointer to the LRU cache structure.
+ * @param cache_count Pointer to the current count of cache entries.
+ * @param rep_strategy Replacement strategy for the cache (0: LRU, 1: Random).
+ */
+void cache_resize(int capacity, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy) {
+    pthread_mutex_lock(&cache_lock);
+    resize_locked(capacity, cache_hash_table, hash_table_size, lru_cache, cache_count, rep_strategy);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+
+/**
+ * Start estimating the hit ratio the cache would have at other sizes and,
+ * if the configuration allows it, resize the cache as lookups come in.
+ * 
+ * @param config The memory ceiling, target hit ratio and sampling to use.
+ * @return 0 on success, -1 if the configuration is invalid.
+ */
+int cache_enable_autosize(const t_sizer_config* config) {
+    pthread_mutex_lock(&cache_lock);
+    int rc = sizer_init(config, sizeof(t_cache_hash_entry) + sizeof(t_lru_node));
+    pthread_mutex_unlock(&cache_lock);
+    return rc;
+}
+
+
+/**
+ * Stop estimating and resizing. The capacity stays where it is.
+ */
+void cache_disable_autosize(void) {
+    pthread_mutex_lock(&cache_lock);
+    sizer_free();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+
 /**
  * Retrieve a message from the cache.
  * 
@@ -187,10 +287,15 @@ int random_replacement(t_cache_hash_entry *cache_hash_table[], int hash_table_si
  * @param lru_cache Pointer to the LRU cache structure.
  * @param cache_count Pointer to the current count of cache entries.
  * @param rep_strategy Replacement strategy for the cache (0: LRU, 1: Random).
- * @return Pointer to the message status structure, or NULL if not found.
+ * @return Pointer to a copy of the message status (1: in cache, 2: on disk, 3: not found), or NULL on failure. The caller is responsible for freeing it.
  */
 t_message_status* retrieve_msg(int identifier, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy) {
-    int hash_index = identifier % hash_table_size;
+    int hash_index = hash_bucket(identifier, hash_table_size);
+    pthread_mutex_lock(&cache_lock);
+    // The sizer's stack and histogram are shared by every caller, so they are kept under the cache lock too
+    if (sizer_record(identifier)) {
+        resize_locked(sizer_recommend(cache_capacity), cache_hash_table, hash_table_size, lru_cache, cache_count, rep_strategy);
+    }
     t_cache_hash_entry* entry = cache_hash_table[hash_index];
 
     // Search the cache for the message
@@ -199,43 +304,44 @@ t_message_status* retrieve_msg(int identifier, t_cache_hash_entry* cache_hash_ta
             entry->time_search = current_timestamp_ms();
             entry->message_with_status.hit_status = 1; // 1 indicates found in cache
             move_node_to_lru_head(lru_cache, entry->lru_node);
+            // Copy the hit before unlocking: the entry may be evicted and reused at any time after
+            t_message_status hit = entry->message_with_status;
+            pthread_mutex_unlock(&cache_lock);
             printf("Message %d retrieved from cache.\n", identifier);
 
-            return &entry->message_with_status;
+            t_message_status* msg_status = (t_message_status*)malloc(sizeof(t_message_status));
+            if (!msg_status) {
+                fprintf(stderr, "Memory allocation failed.\n");
+                return NULL;
+            }
+            *msg_status = hit;
+            return msg_status;
         }
         entry = entry->next;
     }
+    pthread_mutex_unlock(&cache_lock);
 
-    // Search the disk for the message
-    FILE* file = fopen("messages.txt", "r");
-    if (file) {
-        t_message msg;
-        char line[1024];
-        while (fgets(line, sizeof(line), file) != NULL) {
-            if (sscanf(line, "%d %ld %99s %99s %899s %d", &msg.identifier, &msg.time_sent, msg.sender, msg.receiver, msg.content, &msg.delivered) == 6) {
-                if (msg.identifier == identifier) {
-                    t_message* retrieved_msg = create_msg(msg.identifier, msg.sender, msg.receiver, msg.content, msg.delivered, CONTEXT_SIZE);
-                    retrieved_msg->time_sent = msg.time_sent;
-                    fclose(file);
-                    printf("Message not found in cache, message %d was found in the disk.\n", identifier);
-
-                    if (retrieved_msg) {
-                        store_msg(retrieved_msg, cache_hash_table, hash_table_size, lru_cache, cache_count, rep_strategy);
-
-
-                        t_message_status* msg_status = (t_message_status*)malloc(sizeof(t_message_status));
-                        if (!msg_status) {
-                            fprintf(stderr, "Memory allocation failed.\n");
-                            return NULL;
-                        }
-                        *msg_status = (t_message_status){ .message = msg, .hit_status = 2 }; // 2 indicates found on disk
-                        return msg_status;
-                        free(retrieved_msg);
-                    }
-                }
-            }
+    // Search the prefetch buffer, then the disk for the message
+    t_message msg;
+    bool found = false;
+    if (prefetch_take(identifier, &msg) == 1) {
+        printf("Message not found in cache, message %d was prefetched from the disk.\n", identifier);
+        found = true;
+    } else if (store_get(identifier, &msg) == 1) {
+        printf("Message not found in cache, message %d was found in the disk.\n", identifier);
+        prefetch_on_miss(identifier);
+        found = true;
+    }
+    if (found) {
+        store_msg(&msg, cache_hash_table, hash_table_size, lru_cache, cache_count, rep_strategy);
+
+        t_message_status* msg_status = (t_message_status*)malloc(sizeof(t_message_status));
+        if (!msg_status) {
+            fprintf(stderr, "Memory allocation failed.\n");
+            return NULL;
         }
-        fclose(file);
+        *msg_status = (t_message_status){ .message = msg, .hit_status = 2 }; // 2 indicates found on disk
+        return msg_status;
     }
 
     // message not found on disk
@@ -250,32 +356,45 @@ t_message_status* retrieve_msg(int identifier, t_cache_hash_entry* cache_hash_ta
 
 
 /**
- * Store a message in the cache.
+ * Add a message to the cache only, without writing it to disk.
  * 
- * @param msg Pointer to the message to be stored.
+ * @param msg Pointer to the message to be cached.
  * @param cache_hash_table Array of pointers to cache hash table entries.
  * @param hash_table_size Size of the hash table.
  * @param lru_cache Pointer to the LRU cache structure.
  * @param cache_count Pointer to the current count of cache entries.
  * @param rep_strategy Replacement strategy for the cache (0: LRU, 1: Random).
  */
-void store_msg(const t_message* msg, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy) {
+void cache_msg(const t_message* msg, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy) {
     // if the msg is NULL, return
     if (!msg) return;
     // hash the msg identifier
     int id = msg->identifier;
-    int hash_index = id % hash_table_size;
-    t_cache_hash_entry* new_entry = (t_cache_hash_entry*)malloc(sizeof(t_cache_hash_entry));
-    if (!new_entry) {
-        fprintf(stderr, "Error: Memory allocation failed for t_cache_hash_entry.\n");
-        return;
-    }
+    int hash_index = hash_bucket(id, hash_table_size);
+    pthread_mutex_lock(&cache_lock);
+
+    // Take an entry the evictor freed ahead of time, or allocate one
+    t_cache_hash_entry* new_entry = spare_entries;
+    t_lru_node* new_node = NULL;
+    if (new_entry) {
+        spare_entries = new_entry->next;
+        spare_count--;
+        new_node = new_entry->lru_node;
+    } else {
+        new_entry = (t_cache_hash_entry*)malloc(sizeof(t_cache_hash_entry));
+        if (!new_entry) {
+            pthread_mutex_unlock(&cache_lock);
+            fprintf(stderr, "Error: Memory allocation failed for t_cache_hash_entry.\n");
+            return;
+        }
 
-    t_lru_node* new_node = (t_lru_node*)malloc(sizeof(t_lru_node));
-    if (!new_node || !new_entry) {
-        fprintf(stderr, "Error: Memory allocation failed for t_lru_node.\n");
-        free(new_entry);
-        return;
+        new_node = (t_lru_node*)malloc(sizeof(t_lru_node));
+        if (!new_node) {
+            pthread_mutex_unlock(&cache_lock);
+            fprintf(stderr, "Error: Memory allocation failed for t_lru_node.\n");
+            free(new_entry);
+            return;
+        }
     }
 
     new_entry->key = id;
@@ -289,46 +408,316 @@ void store_msg(const t_message* msg, t_cache_hash_entry* cache_hash_table[], int
     new_node->prev = NULL;
     new_node->next = NULL;
 
-    if (*cache_count >= CACHE_SIZE) {
-        if (rep_strategy == 1) {
+    // No free slot: the evictor is off or has fallen behind, so evict inline
+    if (*cache_count >= cache_capacity) {
+        if (rep_strategy == 0) {
             lru_replacement(cache_hash_table, hash_table_size, lru_cache, cache_count);
-        } else if (rep_strategy == 0) {
+        } else if (rep_strategy == 1) {
             random_replacement(cache_hash_table, hash_table_size, lru_cache, cache_count);
         }
+        evictor_stats.inline_evictions++;
     }
 
     new_entry->next = cache_hash_table[hash_index];
     cache_hash_table[hash_index] = new_entry;
     (*cache_count)++;
     add_node_to_lru_head(lru_cache, new_node);
+    if (evictor_running && cache_capacity - *cache_count < evictor_low) {
+        pthread_cond_signal(&evictor_cond);
+    }
+    pthread_mutex_unlock(&cache_lock);
     printf("Message %d stored in cache.\n", id);
+}
 
-    // Store message in file to disk, check if message already exists
-    FILE* file = fopen("./messages.txt", "r");
-    int exists = 0;
-    if (file) {
-        char line[1024];
-        while (fgets(line, sizeof(line), file) != NULL) {
-            int stored_id;
-            if (sscanf(line, "%d", &stored_id) == 1 && stored_id == id) {
-                exists = 1;
-                break;
-            }
+
+/**
+ * Store a message in the cache.
+ * 
+ * @param msg Pointer to the message to be stored.
+ * @param cache_hash_table Array of pointers to cache hash table entries.
+ * @param hash_table_size Size of the hash table.
+ * @param lru_cache Pointer to the LRU cache structure.
+ * @param cache_count Pointer to the current count of cache entries.
+ * @param rep_strategy Replacement strategy for the cache (0: LRU, 1: Random).
+ */
+void store_msg(const t_message* msg, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy) {
+    if (!msg) return;
+    cache_msg(msg, cache_hash_table, hash_table_size, lru_cache, cache_count, rep_strategy);
+
+    // Store message in file to disk, unless it already exists
+    int stored = store_insert(msg);
+    if (stored == 1) {
+        printf("Message %d stored in file.\n", msg->identifier);
+    } else if (stored < 0) {
+        fprintf(stderr, "Error: Unable to store message %d on disk.\n", msg->identifier);
+    }
+}
+
+
+/**
+ * Update a message on disk and in the cache.
+ * 
+ * @param msg Pointer to the new version of the message.
+ * @param cache_hash_table Array of pointers to cache hash table entries.
+ * @param hash_table_size Size of the hash table.
+ * @param lru_cache Pointer to the LRU cache structure.
+ * @return 0 on success, -1 if the message does not exist.
+ */
+int update_msg(const t_message* msg, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache) {
+    if (!msg) return -1;
+    if (store_update(msg) != 0) {
+        fprintf(stderr, "Error: Unable to update message %d.\n", msg->identifier);
+        return -1;
+    }
+    prefetch_invalidate(msg->identifier);
+
+    // Refresh the cached copy in place, without changing its recency
+    int hash_index = hash_bucket(msg->identifier, hash_table_size);
+    pthread_mutex_lock(&cache_lock);
+    for (t_cache_hash_entry* entry = cache_hash_table[hash_index]; entry; entry = entry->next) {
+        if (entry->key == msg->identifier) {
+            entry->message_with_status.message = *msg;
         }
-        fclose(file);
     }
+    pthread_mutex_unlock(&cache_lock);
+    printf("Message %d updated.\n", msg->identifier);
+    return 0;
+}
+
 
-    // if message does not exist, store it in file
-    if (!exists) {
-        file = fopen("./messages.txt", "a");
-        if (file) {
-            fprintf(file, "%d %ld %s %s %s %d\n", msg->identifier, msg->time_sent, msg->sender, msg->receiver, msg->content, msg->delivered);
-            printf("Message %d stored in file.\n", id);
-            fclose(file);
+/**
+ * Delete a message from disk and from the cache.
+ * 
+ * @param identifier The unique identifier of the message to delete.
+ * @param cache_hash_table Array of pointers to cache hash table entries.
+ * @param hash_table_size Size of the hash table.
+ * @param lru_cache Pointer to the LRU cache structure.
+ * @param cache_count Pointer to the current count of cache entries.
+ * @return 0 on success, -1 if the message was neither on disk nor in the cache.
+ */
+int delete_msg(int identifier, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count) {
+    int deleted = store_delete(identifier) == 0;
+    prefetch_invalidate(identifier);
+
+    int hash_index = hash_bucket(identifier, hash_table_size);
+    pthread_mutex_lock(&cache_lock);
+    t_cache_hash_entry* current = cache_hash_table[hash_index];
+    t_cache_hash_entry* prev = NULL;
+    while (current) {
+        t_cache_hash_entry* next = current->next;
+        if (current->key == identifier) {
+            if (prev) {
+                prev->next = next;
+            } else {
+                cache_hash_table[hash_index] = next;
+            }
+            remove_node_from_lru(lru_cache, current->lru_node);
+            free(current->lru_node);
+            free(current);
+            (*cache_count)--;
+            deleted = 1;
         } else {
-            fprintf(stderr, "Error: Unable to open file messages.txt for writing.\n");
+            prev = current;
+        }
+        current = next;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    if (!deleted) {
+        return -1;
+    }
+    printf("Message %d deleted.\n", identifier);
+    return 0;
+}
+
+
+/**
+ * Mark messages as delivered in one batch. The delivery bitmap is updated
+ * instead of the records, and cached copies are updated in place.
+ * 
+ * @param identifiers The unique identifiers of the messages.
+ * @param count Number of identifiers.
+ * @param cache_hash_table Array of pointers to cache hash table entries.
+ * @param hash_table_size Size of the hash table.
+ * @return Number of messages newly marked, or -1 on failure.
+ */
+int mark_delivered(const int* identifiers, int count, t_cache_hash_entry* cache_hash_table[], int hash_table_size) {
+    if (count <= 0) return 0;
+    int* results = (int*)malloc(sizeof(int) * count);
+    if (!results) {
+        fprintf(stderr, "Error: Memory allocation failed for delivery batch.\n");
+        return -1;
+    }
+    int marked = store_mark_delivered(identifiers, count, results);
+    for (int i = 0; marked >= 0 && i < count; i++) {
+        if (results[i] < 0) continue;
+        prefetch_invalidate(identifiers[i]);
+        int hash_index = hash_bucket(identifiers[i], hash_table_size);
+        pthread_mutex_lock(&cache_lock);
+        for (t_cache_hash_entry* entry = cache_hash_table[hash_index]; entry; entry = entry->next) {
+            if (entry->key == identifiers[i]) {
+                entry->message_with_status.message.delivered = 1;
+            }
         }
+        pthread_mutex_unlock(&cache_lock);
+    }
+    free(results);
+    return marked;
+}
+
+
+/**
+ * Unlinks one victim from the cache and keeps its entry as a spare, or frees
+ * it once there are enough spares. Nothing is printed, unlike the inline path.
+ * 
+ * @return 1 if an entry was evicted, 0 if the cache is empty.
+ */
+static int evict_one_locked(void) {
+    if (*evictor_count == 0 || !evictor_lru->tail) return 0;
+
+    // LRU takes the tail; random takes the first entry from a random bucket onwards
+    int hash_index;
+    int key = -1;
+    if (evictor_strategy == 1) {
+        hash_index = rand_r(&evictor_seed) % evictor_table_size;
+        while (!evictor_table[hash_index]) hash_index = (hash_index + 1) % evictor_table_size;
+        key = evictor_table[hash_index]->key;
     } else {
-        printf("Error: Unable to open file messages.txt for writing.\n");
+        key = evictor_lru->tail->key;
+        hash_index = hash_bucket(key, evictor_table_size);
     }
-}
\ No newline at end of file
+
+    t_cache_hash_entry** link = &evictor_table[hash_index];
+    while (*link && (*link)->key != key) link = &(*link)->next;
+    if (!*link) {
+        fprintf(stderr, "Error: Inconsistency found in LRU cache.\n");
+        return 0;
+    }
+    t_cache_hash_entry* victim = *link;
+    *link = victim->next;
+    remove_node_from_lru(evictor_lru, victim->lru_node);
+    (*evictor_count)--;
+    evictor_stats.background_evictions++;
+
+    if (spare_count < evictor_high) {
+        victim->next = spare_entries;
+        spare_entries = victim;
+        spare_count++;
+    } else {
+        free(victim->lru_node);
+        free(victim);
+    }
+    return 1;
+}
+
+static void *evictor_main(void *arg) {
+    pthread_mutex_lock(&cache_lock);
+    while (!evictor_stop) {
+        // The capacity may have been resized since the evictor started
+        int low = evictor_low < cache_capacity ? evictor_low : cache_capacity - 1;
+        int high = evictor_high < cache_capacity ? evictor_high : cache_capacity - 1;
+        int evicted = 0;
+        if (cache_capacity - *evictor_count < low) {
+            // Restore the high watermark, letting stores in between batches
+            evictor_stats.batches++;
+            int batch;
+            do {
+                batch = 0;
+                while (batch < EVICTOR_BATCH && cache_capacity - *evictor_count < high && evict_one_locked()) batch++;
+                evicted += batch;
+                pthread_mutex_unlock(&cache_lock);
+                pthread_mutex_lock(&cache_lock);
+            } while (!evictor_stop && batch > 0 && cache_capacity - *evictor_count < high);
+        }
+        if (!evictor_stop && evicted == 0) {
+            pthread_cond_wait(&evictor_cond, &cache_lock);
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return NULL;
+}
+
+
+/**
+ * Start a background thread that keeps free slots in the cache, so stores
+ * rarely pay for an eviction. When fewer than low_watermark slots are free it
+ * evicts, in batches and without printing, until high_watermark are free, and
+ * keeps the evicted entries for the next stores to reuse. Stores that find
+ * the cache full still evict inline. The cache then holds between
+ * capacity - high_watermark and capacity - low_watermark messages.
+ * 
+ * @param low_watermark Free slots below which eviction starts, at least 1.
+ * @param high_watermark Free slots restored, between low_watermark and the capacity.
+ * @param cache_hash_table Array of pointers to cache hash table entries.
+ * @param hash_table_size Size of the hash table.
+ * @param lru_cache Pointer to the LRU cache structure.
+ * @param cache_count Pointer to the current count of cache entries.
+ * @param rep_strategy Replacement strategy for the cache (0: LRU, 1: Random).
+ * @return 0 on success, -1 if the watermarks are invalid or the evictor is already running.
+ */
+int cache_start_evictor(int low_watermark, int high_watermark, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy) {
+    pthread_mutex_lock(&cache_lock);
+    if (evictor_running || low_watermark < 1 || high_watermark < low_watermark || high_watermark >= cache_capacity) {
+        pthread_mutex_unlock(&cache_lock);
+        fprintf(stderr, "Error: Unable to start the cache evictor.\n");
+        return -1;
+    }
+    evictor_low = low_watermark;
+    evictor_high = high_watermark;
+    evictor_table = cache_hash_table;
+    evictor_table_size = hash_table_size;
+    evictor_lru = lru_cache;
+    evictor_count = cache_count;
+    evictor_strategy = rep_strategy;
+    evictor_stop = false;
+    memset(&evictor_stats, 0, sizeof(evictor_stats));
+    if (pthread_create(&evictor_thread, NULL, evictor_main, NULL) != 0) {
+        pthread_mutex_unlock(&cache_lock);
+        fprintf(stderr, "Error: Unable to start the cache evictor.\n");
+        return -1;
+    }
+    evictor_running = true;
+    pthread_cond_signal(&evictor_cond);
+    pthread_mutex_unlock(&cache_lock);
+    return 0;
+}
+
+
+/**
+ * Stop the background evictor and free the spare entries it kept.
+ */
+void cache_stop_evictor(void) {
+    pthread_mutex_lock(&cache_lock);
+    if (!evictor_running) {
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+    evictor_stop = true;
+    pthread_cond_signal(&evictor_cond);
+    pthread_mutex_unlock(&cache_lock);
+    pthread_join(evictor_thread, NULL);
+
+    pthread_mutex_lock(&cache_lock);
+    evictor_running = false;
+    while (spare_entries) {
+        t_cache_hash_entry* next = spare_entries->next;
+        free(spare_entries->lru_node);
+        free(spare_entries);
+        spare_entries = next;
+    }
+    spare_count = 0;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+
+/**
+ * Report how evictions were split between the background thread and stores.
+ * 
+ * @param stats Filled in with the counters since the evictor was started.
+ */
+void cache_get_evictor_stats(t_evictor_stats* stats) {
+    pthread_mutex_lock(&cache_lock);
+    *stats = evictor_stats;
+    stats->spare_entries = spare_count;
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -2,9 +2,10 @@
 #define CACHE_H
 
 #include "message.h"
+#include "sizer.h"
 #include <sys/time.h>
 
-#define CACHE_SIZE 16
+#define CACHE_SIZE 16 // initial capacity, see cache_resize
 /**
  * @brief message status structure, used to return the status of the message
  */
@@ -40,6 +41,18 @@ typedef struct t_lru_cache{
     struct t_lru_node *tail;
 } t_lru_cache;
 
+#define EVICTOR_BATCH 32 // evictions between two releases of the cache lock
+
+/**
+ * @brief how evictions were split between the background evictor and stores
+ */
+typedef struct t_evictor_stats {
+    long background_evictions;
+    long inline_evictions; // stores that found no free slot
+    long batches; // times the evictor woke up to restore the high watermark
+    int spare_entries; // evicted entries waiting to be reused
+} t_evictor_stats;
+
 
 void add_node_to_lru_head(t_lru_cache *lru_cache, t_lru_node *node);
 void remove_node_from_lru(t_lru_cache *lru_cache, t_lru_node *node);
@@ -48,8 +61,21 @@ void move_node_to_lru_head(t_lru_cache *lru_cache, t_lru_node *node);
 int lru_replacement(t_cache_hash_entry *cache_hash_table[], int hash_table_size, t_lru_cache *lru_cache, int *cache_count);
 int random_replacement(t_cache_hash_entry *cache_hash_table[], int hash_table_size, t_lru_cache *lru_cache, int *cache_count);
 
+int cache_get_capacity(void);
+void cache_resize(int capacity, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy);
+int cache_enable_autosize(const t_sizer_config* config);
+void cache_disable_autosize(void);
+
 t_message_status* retrieve_msg(int identifier, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy);
+void cache_msg(const t_message* msg, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy);
 void store_msg(const t_message* msg, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy);
+int update_msg(const t_message* msg, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache);
+int delete_msg(int identifier, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count);
+int mark_delivered(const int* identifiers, int count, t_cache_hash_entry* cache_hash_table[], int hash_table_size);
+
+int cache_start_evictor(int low_watermark, int high_watermark, t_cache_hash_entry* cache_hash_table[], int hash_table_size, t_lru_cache* lru_cache, int* cache_count, int rep_strategy);
+void cache_stop_evictor(void);
+void cache_get_evictor_stats(t_evictor_stats* stats);
 
 
 
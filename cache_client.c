@@ -0,0 +1,251 @@
+#include "cache_client.h"
+#include "protocol.h"
+#include "message.h"
+#include "cache.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CLIENT_READ_CHUNK (64 * 1024)
+
+
+/**
+ * Connect to a cache daemon.
+ *
+ * @param socket_path Path of the daemon's Unix domain socket.
+ * @return Pointer to the new client, or NULL on failure. Release it with client_close.
+ */
+t_cache_client* client_connect(const char* socket_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long.\n", socket_path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    t_cache_client* client = (t_cache_client*)malloc(sizeof(t_cache_client));
+    if (!client) {
+        fprintf(stderr, "Error: Memory allocation failed for t_cache_client.\n");
+        close(fd);
+        return NULL;
+    }
+    client->fd = fd;
+    client->next_request_id = 1;
+    proto_buffer_init(&client->out);
+    proto_buffer_init(&client->in);
+    return client;
+}
+
+/**
+ * Close the connection to a cache daemon and free the client.
+ *
+ * @param client Pointer to the client.
+ */
+void client_close(t_cache_client* client) {
+    if (!client) return;
+    close(client->fd);
+    proto_buffer_free(&client->out);
+    proto_buffer_free(&client->in);
+    free(client);
+}
+
+/**
+ * Sends every request queued in the output buffer.
+ */
+static int send_queued(t_cache_client* client) {
+    while (client->out.pos < client->out.len) {
+        ssize_t n = write(client->fd, client->out.data + client->out.pos, client->out.len - client->out.pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        proto_buffer_consume(&client->out, n);
+    }
+    return 0;
+}
+
+/**
+ * Waits for the next response frame.
+ *
+ * @param client Pointer to the client.
+ * @param request_id The request id the response must answer.
+ * @param pos Set to the start of the response payload.
+ * @param end Set to the end of the response payload.
+ * @param frame_size Set to the number of bytes to consume once the payload has been decoded.
+ * @return The response status, or -1 on failure.
+ */
+static int read_response(t_cache_client* client, uint32_t request_id, const unsigned char** pos, const unsigned char** end, size_t* frame_size) {
+    uint32_t length;
+    int ready;
+    while ((ready = proto_frame_ready(&client->in, &length)) == 0) {
+        if (proto_buffer_reserve(&client->in, CLIENT_READ_CHUNK) != 0) return -1;
+        ssize_t n = read(client->fd, client->in.data + client->in.len, client->in.cap - client->in.len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        client->in.len += n;
+    }
+    if (ready < 0) return -1;
+
+    *pos = client->in.data + client->in.pos + sizeof(uint32_t);
+    *end = *pos + length;
+    *frame_size = sizeof(uint32_t) + length;
+
+    uint32_t response_id;
+    uint8_t status;
+    if (proto_get_u32(pos, *end, &response_id) != 0 || proto_get_u8(pos, *end, &status) != 0 || response_id != request_id) {
+        return -1;
+    }
+    return status;
+}
+
+static int queue_get(t_cache_client* client, uint32_t request_id, int identifier) {
+    size_t frame_start;
+    if (proto_begin_frame(&client->out, request_id, OP_GET, &frame_start) != 0 || proto_put_u32(&client->out, (uint32_t)identifier) != 0) {
+        return -1;
+    }
+    proto_end_frame(&client->out, frame_start);
+    return 0;
+}
+
+static int queue_put(t_cache_client* client, uint32_t request_id, const t_message* msg) {
+    size_t frame_start;
+    if (proto_begin_frame(&client->out, request_id, OP_PUT, &frame_start) != 0 || proto_put_message(&client->out, msg) != 0) {
+        return -1;
+    }
+    proto_end_frame(&client->out, frame_start);
+    return 0;
+}
+
+/**
+ * Retrieve a message through the daemon's cache, like retrieve_msg.
+ *
+ * @param client Pointer to the client.
+ * @param identifier The unique identifier of the message to retrieve.
+ * @return Pointer to the message status (1: in cache, 2: on disk, 3: not found), or NULL on failure. The caller is responsible for freeing it.
+ */
+t_message_status* client_retrieve_msg(t_cache_client* client, int identifier) {
+    uint32_t request_id = client->next_request_id++;
+    if (queue_get(client, request_id, identifier) != 0 || send_queued(client) != 0) {
+        return NULL;
+    }
+
+    const unsigned char *pos, *end;
+    size_t frame_size;
+    int response = read_response(client, request_id, &pos, &end, &frame_size);
+    if (response < 0) {
+        return NULL;
+    }
+    if (response != STATUS_OK) {
+        proto_buffer_consume(&client->in, frame_size); // keep the connection in step for the next request
+        return NULL;
+    }
+    t_message_status* status = (t_message_status*)malloc(sizeof(t_message_status));
+    if (!status || proto_get_status(&pos, end, status) != 0) {
+        free(status);
+        status = NULL;
+    }
+    proto_buffer_consume(&client->in, frame_size);
+    return status;
+}
+
+/**
+ * Store a message through the daemon's cache, like store_msg.
+ *
+ * @param client Pointer to the client.
+ * @param msg Pointer to the message to be stored.
+ * @return 0 on success, -1 on failure.
+ */
+int client_store_msg(t_cache_client* client, const t_message* msg) {
+    return client_store_msgs(client, msg, 1);
+}
+
+/**
+ * Retrieve several messages with multi-get requests. Requests of more than
+ * PROTO_MAX_MGET ids are split, and the pieces are pipelined.
+ *
+ * @param client Pointer to the client.
+ * @param identifiers The identifiers of the messages to retrieve.
+ * @param count Number of identifiers.
+ * @param statuses Array of count statuses to fill in, in the order of the identifiers.
+ * @return 0 on success, -1 on failure.
+ */
+int client_retrieve_msgs(t_cache_client* client, const int* identifiers, int count, t_message_status* statuses) {
+    uint32_t first_id = client->next_request_id;
+    for (int start = 0; start < count; start += PROTO_MAX_MGET) {
+        int batch = count - start < PROTO_MAX_MGET ? count - start : PROTO_MAX_MGET;
+        size_t frame_start;
+        if (proto_begin_frame(&client->out, client->next_request_id++, OP_MGET, &frame_start) != 0 || proto_put_u32(&client->out, batch) != 0) {
+            return -1;
+        }
+        for (int i = 0; i < batch; i++) {
+            if (proto_put_u32(&client->out, (uint32_t)identifiers[start + i]) != 0) return -1;
+        }
+        proto_end_frame(&client->out, frame_start);
+    }
+    if (send_queued(client) != 0) return -1;
+
+    int rc = 0;
+    uint32_t request_id = first_id;
+    for (int start = 0; start < count; start += PROTO_MAX_MGET, request_id++) {
+        const unsigned char *pos, *end;
+        size_t frame_size;
+        uint32_t batch;
+        int response = read_response(client, request_id, &pos, &end, &frame_size);
+        if (response < 0) {
+            return -1; // the stream is out of step, the connection cannot be reused
+        }
+        if (response != STATUS_OK || proto_get_u32(&pos, end, &batch) != 0) {
+            // A rejected piece still has its frame, and the later pieces follow it
+            proto_buffer_consume(&client->in, frame_size);
+            rc = -1;
+            continue;
+        }
+        for (uint32_t i = 0; i < batch && rc == 0; i++) {
+            if (start + (int)i >= count || proto_get_status(&pos, end, &statuses[start + i]) != 0) {
+                rc = -1;
+            }
+        }
+        proto_buffer_consume(&client->in, frame_size);
+    }
+    return rc;
+}
+
+/**
+ * Store several messages, pipelining one put request per message before
+ * reading any of the responses.
+ *
+ * @param client Pointer to the client.
+ * @param msgs Array of messages to store.
+ * @param count Number of messages.
+ * @return 0 if every message was stored, -1 otherwise.
+ */
+int client_store_msgs(t_cache_client* client, const t_message* msgs, int count) {
+    uint32_t first_id = client->next_request_id;
+    for (int i = 0; i < count; i++) {
+        if (queue_put(client, client->next_request_id++, &msgs[i]) != 0) return -1;
+    }
+    if (send_queued(client) != 0) return -1;
+
+    int rc = 0;
+    for (int i = 0; i < count; i++) {
+        const unsigned char *pos, *end;
+        size_t frame_size;
+        int status = read_response(client, first_id + i, &pos, &end, &frame_size);
+        if (status < 0) return -1;
+        if (status != STATUS_OK) rc = -1;
+        proto_buffer_consume(&client->in, frame_size);
+    }
+    return rc;
+}
@@ -0,0 +1,26 @@
+#ifndef CACHE_CLIENT_H
+#define CACHE_CLIENT_H
+
+#include "message.h"
+#include "cache.h"
+#include "protocol.h"
+
+/**
+ * @brief connection to a cache daemon
+ */
+typedef struct t_cache_client {
+    int fd;
+    uint32_t next_request_id;
+    t_proto_buffer out;
+    t_proto_buffer in;
+} t_cache_client;
+
+t_cache_client* client_connect(const char* socket_path);
+void client_close(t_cache_client* client);
+
+t_message_status* client_retrieve_msg(t_cache_client* client, int identifier);
+int client_store_msg(t_cache_client* client, const t_message* msg);
+int client_retrieve_msgs(t_cache_client* client, const int* identifiers, int count, t_message_status* statuses);
+int client_store_msgs(t_cache_client* client, const t_message* msgs, int count);
+
+#endif // CACHE_CLIENT_H
@@ -0,0 +1,297 @@
+#include "cache_server.h"
+#include "protocol.h"
+#include "message.h"
+#include "cache.h"
+#include "msg_scan.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * @brief one client connection, with its unparsed requests and unsent responses
+ */
+typedef struct t_connection {
+    int fd;
+    t_proto_buffer in;
+    t_proto_buffer out;
+    bool writing; // EPOLLOUT is armed
+} t_connection;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+// The daemon owns the one cache every client shares
+static t_cache_hash_entry *cache_hash_table[CACHE_SIZE];
+static t_lru_cache lru_cache = {NULL, NULL};
+static int cache_count = 0;
+static int strategy = 0;
+
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Appends the hit status of one lookup, and the message when there is one.
+ * Negative ids are rejected, as no message can have one.
+ */
+static int put_lookup(t_proto_buffer *out, int identifier) {
+    if (identifier < 0) return -1;
+    t_message_status *status = retrieve_msg(identifier, cache_hash_table, CACHE_SIZE, &lru_cache, &cache_count, strategy);
+    if (!status) return -1;
+    int rc = proto_put_u8(out, (uint8_t)status->hit_status);
+    if (rc == 0 && status->hit_status != 3) {
+        rc = proto_put_message(out, &status->message);
+    }
+    free(status);
+    return rc;
+}
+
+/**
+ * Executes one request frame and appends its response to the connection.
+ *
+ * @param conn Pointer to the connection.
+ * @param frame The frame, starting at its request id.
+ * @param length Length of the frame.
+ * @return 0 on success, -1 if the response could not be built.
+ */
+static int handle_request(t_connection *conn, const unsigned char *frame, uint32_t length) {
+    const unsigned char *pos = frame;
+    const unsigned char *end = frame + length;
+    uint32_t request_id, count;
+    uint8_t opcode;
+    int32_t identifier;
+    t_message msg;
+    size_t frame_start;
+
+    proto_get_u32(&pos, end, &request_id);
+    proto_get_u8(&pos, end, &opcode);
+    size_t response_start = conn->out.len;
+    if (proto_begin_frame(&conn->out, request_id, STATUS_OK, &frame_start) != 0) return -1;
+
+    int rc = -1;
+    switch (opcode) {
+    case OP_GET:
+        if (proto_get_u32(&pos, end, (uint32_t *)&identifier) == 0 && pos == end) {
+            rc = put_lookup(&conn->out, identifier);
+        }
+        break;
+    case OP_PUT:
+        // Only messages the store could read back are accepted, as ingest does
+        if (proto_get_message(&pos, end, &msg) == 0 && pos == end && scan_msg_storable(&msg)) {
+            store_msg(&msg, cache_hash_table, CACHE_SIZE, &lru_cache, &cache_count, strategy);
+            rc = 0;
+        }
+        break;
+    case OP_MGET:
+        if (proto_get_u32(&pos, end, &count) == 0 && count <= PROTO_MAX_MGET && (size_t)(end - pos) == count * sizeof(int32_t)) {
+            // Check every id before looking any up, so a bad batch has no effect on the cache
+            const unsigned char *ids = pos;
+            bool valid = true;
+            for (uint32_t i = 0; i < count && valid; i++) {
+                proto_get_u32(&ids, end, (uint32_t *)&identifier);
+                valid = identifier >= 0;
+            }
+            if (!valid) break;
+            rc = proto_put_u32(&conn->out, count);
+            for (uint32_t i = 0; i < count && rc == 0; i++) {
+                proto_get_u32(&pos, end, (uint32_t *)&identifier);
+                rc = put_lookup(&conn->out, identifier);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (rc != 0) {
+        // Replace whatever was written with an empty error response
+        conn->out.len = response_start;
+        if (proto_begin_frame(&conn->out, request_id, STATUS_BAD_REQUEST, &frame_start) != 0) return -1;
+    }
+    proto_end_frame(&conn->out, frame_start);
+    return 0;
+}
+
+static void close_connection(int epoll_fd, t_connection *conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    proto_buffer_free(&conn->in);
+    proto_buffer_free(&conn->out);
+    free(conn);
+}
+
+/**
+ * Sends as much of the pending responses as the socket takes, arming
+ * EPOLLOUT only while some are left over.
+ *
+ * @return 0 on success, -1 if the connection failed.
+ */
+static int flush_connection(int epoll_fd, t_connection *conn) {
+    while (conn->out.pos < conn->out.len) {
+        ssize_t n = write(conn->fd, conn->out.data + conn->out.pos, conn->out.len - conn->out.pos);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        proto_buffer_consume(&conn->out, n);
+    }
+
+    bool pending = conn->out.pos < conn->out.len;
+    if (pending != conn->writing) {
+        struct epoll_event event = { .events = EPOLLIN | (pending ? EPOLLOUT : 0), .data.ptr = conn };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) != 0) return -1;
+        conn->writing = pending;
+    }
+    return 0;
+}
+
+/**
+ * Reads everything available on a connection and answers every complete
+ * request in it, in order.
+ *
+ * @return 0 on success, 1 if the client closed its end, -1 on failure.
+ */
+static int read_connection(t_connection *conn) {
+    bool closed = false;
+    for (;;) {
+        if (proto_buffer_reserve(&conn->in, SERVER_READ_CHUNK) != 0) return -1;
+        ssize_t n = read(conn->fd, conn->in.data + conn->in.len, conn->in.cap - conn->in.len);
+        if (n == 0) {
+            closed = true;
+            break;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        conn->in.len += n;
+    }
+
+    uint32_t length;
+    int ready;
+    while ((ready = proto_frame_ready(&conn->in, &length)) == 1) {
+        const unsigned char *frame = conn->in.data + conn->in.pos + sizeof(uint32_t);
+        if (handle_request(conn, frame, length) != 0) return -1;
+        proto_buffer_consume(&conn->in, sizeof(uint32_t) + length);
+    }
+    if (ready < 0) return -1;
+    return closed ? 1 : 0;
+}
+
+static void accept_connections(int epoll_fd, int listen_fd) {
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return; // EAGAIN: nothing left to accept
+        }
+        t_connection *conn = (t_connection *)calloc(1, sizeof(t_connection));
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = conn };
+        if (!conn || set_nonblocking(fd) != 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            fprintf(stderr, "Error: Unable to register client connection.\n");
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        proto_buffer_init(&conn->in);
+        proto_buffer_init(&conn->out);
+    }
+}
+
+static int listen_on(const char *socket_path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path %s is too long.\n", socket_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("Error creating socket");
+        return -1;
+    }
+    unlink(socket_path); // left behind by a previous daemon
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0 || set_nonblocking(fd) != 0) {
+        perror("Error listening on socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Serves get, put and multi-get requests for one shared cache over a Unix
+ * domain socket, until cache_server_stop is called.
+ *
+ * @param socket_path Path of the socket to listen on.
+ * @param rep_strategy Replacement strategy for the cache (0: LRU, 1: Random).
+ * @return 0 on a clean shutdown, -1 on failure.
+ */
+int cache_server_run(const char *socket_path, int rep_strategy) {
+    strategy = rep_strategy;
+    stop_requested = 0;
+
+    int listen_fd = listen_on(socket_path);
+    if (listen_fd < 0) return -1;
+    int epoll_fd = epoll_create1(0);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) {
+        perror("Error creating epoll instance");
+        close(listen_fd);
+        if (epoll_fd >= 0) close(epoll_fd);
+        return -1;
+    }
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!stop_requested) {
+        int n = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, 100);
+        for (int i = 0; i < n; i++) {
+            t_connection *conn = (t_connection *)events[i].data.ptr;
+            if (!conn) {
+                accept_connections(epoll_fd, listen_fd);
+                continue;
+            }
+            bool done = (events[i].events & (EPOLLERR | EPOLLHUP)) && !(events[i].events & EPOLLIN);
+            int rc = 0;
+            if (!done && (events[i].events & EPOLLIN)) {
+                rc = read_connection(conn);
+                done = rc < 0;
+            }
+            if (!done) {
+                // answer what was already received, even if the client is going away
+                done = flush_connection(epoll_fd, conn) != 0 || rc == 1;
+            }
+            if (done) {
+                close_connection(epoll_fd, conn);
+            }
+        }
+    }
+
+    // Connections still open are dropped along with the process
+    close(epoll_fd);
+    close(listen_fd);
+    unlink(socket_path);
+    return 0;
+}
+
+/**
+ * Asks the server loop to return. Safe to call from a signal handler.
+ */
+void cache_server_stop(void) {
+    stop_requested = 1;
+}
@@ -0,0 +1,10 @@
+#ifndef CACHE_SERVER_H
+#define CACHE_SERVER_H
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_CHUNK (64 * 1024)
+
+int cache_server_run(const char *socket_path, int rep_strategy);
+void cache_server_stop(void);
+
+#endif // CACHE_SERVER_H
@@ -0,0 +1,51 @@
+#include "cache_server.h"
+#include "store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+
+static void handle_signal(int signum) {
+    cache_server_stop();
+}
+
+
+int main(int argc, char *argv[]) {
+    // Check command-line arguments first
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: cache_daemon <socket path> [0 for LRU | 1 for Random] [message file]\n");
+        return EXIT_FAILURE;
+    }
+
+    int replacement_strategy = 0;
+    if (argc >= 3) {
+        if (strcmp(argv[2], "0") == 0) {
+            replacement_strategy = 0;
+        } else if (strcmp(argv[2], "1") == 0) {
+            replacement_strategy = 1;
+        } else {
+            fprintf(stderr, "Invalid argument. Please use 0 for LRU or 1 for Random.\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    const char *store_path = argc == 4 ? argv[3] : MESSAGE_STORE_FILE;
+    if (store_open(store_path) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN); // a client going away must not kill the daemon
+
+    printf("Cache daemon listening on %s (%s strategy, store %s)\n", argv[1], replacement_strategy == 0 ? "LRU" : "Random", store_path);
+    int rc = cache_server_run(argv[1], replacement_strategy);
+
+    store_close();
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
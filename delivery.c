@@ -0,0 +1,300 @@
+#include "delivery.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Callers (the store) hold their own lock around every call, so none is taken here
+static char delivery_file[PATH_MAX];
+static int delivery_fd = -1;
+static void *mapping = NULL;
+static size_t mapping_size = 0;
+static t_delivery_header *header = NULL;
+static t_delivery_word *words = NULL;
+static long word_count = 0;
+
+
+static size_t file_size_for(long words_wanted) {
+    return DELIVERY_HEADER_BYTES + (size_t)words_wanted * sizeof(t_delivery_word);
+}
+
+/**
+ * Maps the file at its current size, after it was created or grown.
+ */
+static int map_file(long words_wanted) {
+    if (mapping) munmap(mapping, mapping_size);
+    mapping_size = file_size_for(words_wanted);
+    mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, delivery_fd, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = NULL;
+        header = NULL;
+        words = NULL;
+        word_count = 0;
+        return -1;
+    }
+    header = (t_delivery_header *)mapping;
+    words = (t_delivery_word *)((char *)mapping + DELIVERY_HEADER_BYTES);
+    word_count = words_wanted;
+    return 0;
+}
+
+/**
+ * Picks up growth by another process sharing the file: the header is in the
+ * shared mapping, so its word count is always current.
+ */
+static void follow_growth(void) {
+    if (mapping && header->word_count > word_count && map_file(header->word_count) != 0) {
+        fprintf(stderr, "Error: Unable to map delivery bitmap %s.\n", delivery_file);
+    }
+}
+
+/**
+ * Makes room for an id, doubling the file so growth stays rare. New words
+ * are zero, as ftruncate fills them, so their ids read as untracked.
+ */
+static int grow_for(int identifier) {
+    follow_growth();
+    if (!mapping) return -1;
+    long needed = identifier / 64 + 1;
+    if (needed <= word_count) return 0;
+    long words_wanted = word_count > 0 ? word_count : DELIVERY_MIN_WORDS;
+    while (words_wanted < needed) words_wanted *= 2;
+    if (ftruncate(delivery_fd, file_size_for(words_wanted)) != 0 || map_file(words_wanted) != 0) {
+        fprintf(stderr, "Error: Unable to grow delivery bitmap %s.\n", delivery_file);
+        return -1;
+    }
+    header->word_count = words_wanted;
+    return 0;
+}
+
+static bool trackable(int identifier) {
+    return identifier >= 0 && identifier <= DELIVERY_MAX_ID;
+}
+
+/**
+ * Opens the delivery bitmap kept next to a message file, mapping it shared so
+ * every process using the store sees the same bits.
+ *
+ * @param store_path Path to the message file; the bitmap is store_path with DELIVERY_SUFFIX.
+ * @param create Whether to create the bitmap when it does not exist.
+ * @return 1 if an existing bitmap was opened, 0 if an empty one was created, -1 on failure or if it does not exist.
+ */
+int delivery_open(const char *store_path, bool create) {
+    delivery_close();
+    snprintf(delivery_file, sizeof(delivery_file), "%s%s", store_path, DELIVERY_SUFFIX);
+    delivery_fd = open(delivery_file, O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (delivery_fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(delivery_fd, &st) != 0) {
+        delivery_close();
+        return -1;
+    }
+    t_delivery_header existing;
+    bool valid = st.st_size >= DELIVERY_HEADER_BYTES
+        && pread(delivery_fd, &existing, sizeof(existing), 0) == sizeof(existing)
+        && memcmp(existing.magic, DELIVERY_MAGIC, 4) == 0
+        && existing.version == DELIVERY_VERSION
+        && existing.word_count > 0
+        && (size_t)st.st_size >= file_size_for(existing.word_count);
+    if (valid) {
+        if (map_file(existing.word_count) != 0) {
+            fprintf(stderr, "Error: Unable to map delivery bitmap %s.\n", delivery_file);
+            delivery_close();
+            return -1;
+        }
+        return 1;
+    }
+    if (!create) {
+        delivery_close();
+        return -1;
+    }
+
+    // Missing or unreadable: start over with an empty bitmap
+    if (ftruncate(delivery_fd, 0) != 0 || ftruncate(delivery_fd, file_size_for(DELIVERY_MIN_WORDS)) != 0
+            || map_file(DELIVERY_MIN_WORDS) != 0) {
+        fprintf(stderr, "Error: Unable to create delivery bitmap %s.\n", delivery_file);
+        delivery_close();
+        return -1;
+    }
+    header->version = DELIVERY_VERSION;
+    header->word_count = DELIVERY_MIN_WORDS;
+    memcpy(header->magic, DELIVERY_MAGIC, 4);
+    return 0;
+}
+
+/**
+ * Writes the bitmap back and unmaps it.
+ */
+void delivery_close(void) {
+    if (mapping) {
+        msync(mapping, mapping_size, MS_SYNC);
+        munmap(mapping, mapping_size);
+    }
+    if (delivery_fd >= 0) close(delivery_fd);
+    delivery_fd = -1;
+    mapping = NULL;
+    mapping_size = 0;
+    header = NULL;
+    words = NULL;
+    word_count = 0;
+}
+
+int delivery_is_open(void) {
+    return mapping != NULL;
+}
+
+/**
+ * Schedules the changed pages to be written back, without waiting for them.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int delivery_sync(void) {
+    if (!mapping) return 0;
+    return msync(mapping, mapping_size, MS_ASYNC) == 0 ? 0 : -1;
+}
+
+/**
+ * Reads the delivery state of a message.
+ *
+ * @param identifier The unique identifier of the message.
+ * @return 1 if delivered, 0 if not, -1 if the message is not tracked.
+ */
+int delivery_state(int identifier) {
+    follow_growth();
+    if (!mapping || !trackable(identifier) || identifier / 64 >= word_count) return -1;
+    uint64_t bit = 1ULL << (identifier % 64);
+    const t_delivery_word *word = &words[identifier / 64];
+    if (!(word->present & bit)) return -1;
+    return (word->delivered & bit) != 0;
+}
+
+/**
+ * Starts tracking a message with the given state, or resets its state.
+ *
+ * @param identifier The unique identifier of the message.
+ * @param delivered The message's delivery flag.
+ * @return 0 on success, -1 if the id cannot be tracked.
+ */
+int delivery_note(int identifier, int delivered) {
+    if (!mapping || !trackable(identifier) || grow_for(identifier) != 0) return -1;
+    uint64_t bit = 1ULL << (identifier % 64);
+    t_delivery_word *word = &words[identifier / 64];
+    word->present |= bit;
+    if (delivered) word->delivered |= bit;
+    else word->delivered &= ~bit;
+    return 0;
+}
+
+/**
+ * Stops tracking a deleted message.
+ *
+ * @param identifier The unique identifier of the message.
+ */
+void delivery_forget(int identifier) {
+    follow_growth();
+    if (!mapping || !trackable(identifier) || identifier / 64 >= word_count) return;
+    uint64_t bit = 1ULL << (identifier % 64);
+    words[identifier / 64].present &= ~bit;
+    words[identifier / 64].delivered &= ~bit;
+}
+
+/**
+ * Changes the delivery state of a tracked message.
+ *
+ * @param identifier The unique identifier of the message.
+ * @param delivered The new state.
+ * @return 1 if the state changed, 0 if it already had it, -1 if the message is not tracked.
+ */
+int delivery_set(int identifier, int delivered) {
+    int state = delivery_state(identifier);
+    if (state < 0) return -1;
+    if (state == (delivered != 0)) return 0;
+    uint64_t bit = 1ULL << (identifier % 64);
+    if (delivered) words[identifier / 64].delivered |= bit;
+    else words[identifier / 64].delivered &= ~bit;
+    return 1;
+}
+
+/**
+ * Stops tracking every message not in a list, such as messages deleted while
+ * the bitmap was closed.
+ *
+ * @param identifiers The ids that are still live, in any order.
+ * @param count Number of ids.
+ * @return Number of messages no longer tracked, or -1 on failure.
+ */
+int delivery_retain(const int *identifiers, int count) {
+    follow_growth();
+    if (!mapping) return -1;
+    uint64_t *live = (uint64_t *)calloc(word_count, sizeof(uint64_t));
+    if (!live) {
+        fprintf(stderr, "Error: Memory allocation failed for delivery bitmap.\n");
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (trackable(identifiers[i]) && identifiers[i] / 64 < word_count) {
+            live[identifiers[i] / 64] |= 1ULL << (identifiers[i] % 64);
+        }
+    }
+    int dropped = 0;
+    for (long w = 0; w < word_count; w++) {
+        uint64_t stale = words[w].present & ~live[w];
+        if (!stale) continue;
+        dropped += __builtin_popcountll(stale);
+        words[w].present &= live[w];
+        words[w].delivered &= live[w];
+    }
+    free(live);
+    return dropped;
+}
+
+/**
+ * Finds the next undelivered messages, 64 ids per step: each word is reduced
+ * to present & ~delivered and its set bits are read off with count-trailing-zeros.
+ *
+ * @param cursor The first id to look at; advanced past the last id returned. Start at 0.
+ * @param identifiers Array of max ids to fill in, ascending.
+ * @param max Most ids to return.
+ * @return Number of ids returned; 0 once the cursor has passed every tracked id.
+ */
+int delivery_next_undelivered(int *cursor, int *identifiers, int max) {
+    follow_growth();
+    if (!mapping || max <= 0 || *cursor < 0) return 0;
+    int found = 0;
+    long w = *cursor / 64;
+    uint64_t mask = ~0ULL << (*cursor % 64); // ids before the cursor in its first word
+    for (; w < word_count && found < max; w++, mask = ~0ULL) {
+        uint64_t pending = words[w].present & ~words[w].delivered & mask;
+        while (pending && found < max) {
+            int id = (int)(w * 64 + __builtin_ctzll(pending));
+            identifiers[found++] = id;
+            *cursor = id + 1;
+            pending &= pending - 1;
+        }
+    }
+    // Never move a cursor that is already past the bitmap back to its end
+    int past_end = (int)(word_count * 64 > INT_MAX ? INT_MAX : word_count * 64);
+    if (found < max && *cursor < past_end) *cursor = past_end;
+    return found;
+}
+
+/**
+ * Counts the undelivered messages with one popcount per 64 ids.
+ *
+ * @return The number of tracked messages not yet delivered.
+ */
+long delivery_count_undelivered(void) {
+    follow_growth();
+    long count = 0;
+    for (long w = 0; w < word_count; w++) {
+        count += __builtin_popcountll(words[w].present & ~words[w].delivered);
+    }
+    return count;
+}
@@ -0,0 +1,46 @@
+#ifndef DELIVERY_H
+#define DELIVERY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DELIVERY_SUFFIX ".dlv"
+#define DELIVERY_MAGIC "DLVR"
+#define DELIVERY_VERSION 1
+#define DELIVERY_HEADER_BYTES 64 // words start here, cache line aligned
+#define DELIVERY_MIN_WORDS 1024 // 65536 ids
+#define DELIVERY_MAX_ID ((1 << 26) - 1) // larger ids are not tracked (the file would pass 16 MB); the store keeps their flag in the record
+
+/**
+ * @brief delivery state of 64 consecutive ids: bit i of present is set when
+ * message (64 * word + i) is live, and of delivered when it was delivered
+ */
+typedef struct t_delivery_word {
+    uint64_t present;
+    uint64_t delivered;
+} t_delivery_word;
+
+/**
+ * @brief start of the bitmap file, padded to DELIVERY_HEADER_BYTES
+ */
+typedef struct t_delivery_header {
+    char magic[4];
+    int version;
+    long word_count;
+} t_delivery_header;
+
+int delivery_open(const char *store_path, bool create);
+void delivery_close(void);
+int delivery_is_open(void);
+int delivery_sync(void);
+
+int delivery_state(int identifier);
+int delivery_note(int identifier, int delivered);
+void delivery_forget(int identifier);
+int delivery_set(int identifier, int delivered);
+int delivery_retain(const int *identifiers, int count);
+
+int delivery_next_undelivered(int *cursor, int *identifiers, int max);
+long delivery_count_undelivered(void);
+
+#endif // DELIVERY_H
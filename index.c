@@ -0,0 +1,697 @@
+#include "index.h"
+#include "message.h"
+#include "cache.h"
+#include "store.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define INTERN_TABLE_SIZE 1024
+#define MAX_QUERY_LISTS 4
+
+/**
+ * @brief interned string, with the posting lists of messages that use it as sender or receiver
+ */
+typedef struct t_index_term {
+    char *str;
+    unsigned int hash;
+    t_posting_list as_sender;
+    t_posting_list as_receiver;
+    struct t_index_term *next;
+} t_index_term;
+
+/**
+ * @brief cursor used to walk a posting list without decoding it into an array
+ */
+typedef struct t_posting_cursor {
+    const unsigned char *pos;
+    const unsigned char *end;
+    int id;
+} t_posting_cursor;
+
+static t_index_term *intern_table[INTERN_TABLE_SIZE];
+static t_posting_list all_ids;
+static t_posting_list delivered_ids[2];
+static bool index_loaded = false;
+// Guards everything above. The store calls in with store_lock held, so take it after store_lock, never before.
+static pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Hashes a string with FNV-1a.
+ *
+ * @param str The string to hash.
+ * @return The hash value.
+ */
+static unsigned int hash_string(const char *str) {
+    unsigned int hash = 2166136261u;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Looks up an interned string, optionally interning it if missing.
+ *
+ * @param str The string to look up.
+ * @param create Whether to intern the string if it is not found.
+ * @return Pointer to the term, or NULL if not found (or on allocation failure).
+ */
+static t_index_term *intern_lookup(const char *str, bool create) {
+    unsigned int hash = hash_string(str);
+    int bucket = hash % INTERN_TABLE_SIZE;
+    for (t_index_term *term = intern_table[bucket]; term; term = term->next) {
+        if (term->hash == hash && strcmp(term->str, str) == 0) {
+            return term;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+
+    t_index_term *term = (t_index_term *)calloc(1, sizeof(t_index_term));
+    if (!term) {
+        fprintf(stderr, "Error: Memory allocation failed for t_index_term.\n");
+        return NULL;
+    }
+    term->str = strdup(str);
+    if (!term->str) {
+        fprintf(stderr, "Error: Memory allocation failed for interned string.\n");
+        free(term);
+        return NULL;
+    }
+    term->hash = hash;
+    posting_list_init(&term->as_sender);
+    posting_list_init(&term->as_receiver);
+    term->next = intern_table[bucket];
+    intern_table[bucket] = term;
+    return term;
+}
+
+/**
+ * Initializes an empty posting list.
+ *
+ * @param list Pointer to the posting list.
+ */
+void posting_list_init(t_posting_list *list) {
+    list->bytes = NULL;
+    list->len = 0;
+    list->cap = 0;
+    list->count = 0;
+    list->last_id = -1;
+}
+
+/**
+ * Releases the memory held by a posting list.
+ *
+ * @param list Pointer to the posting list.
+ */
+void posting_list_free(t_posting_list *list) {
+    free(list->bytes);
+    posting_list_init(list);
+}
+
+/**
+ * Writes a delta as a varint.
+ *
+ * @param out Buffer with room for 5 bytes.
+ * @param delta The gap to encode.
+ * @return The number of bytes written.
+ */
+static int encode_varint(unsigned char *out, unsigned int delta) {
+    int n = 0;
+    while (delta >= 0x80) {
+        out[n++] = (unsigned char)(delta | 0x80);
+        delta >>= 7;
+    }
+    out[n++] = (unsigned char)delta;
+    return n;
+}
+
+/**
+ * Makes sure a posting list has room for extra more bytes.
+ *
+ * @param list Pointer to the posting list.
+ * @param extra Number of bytes about to be written.
+ * @return 1 on success, 0 on allocation failure.
+ */
+static int posting_list_reserve(t_posting_list *list, size_t extra) {
+    if (list->len + extra <= list->cap) {
+        return 1;
+    }
+    size_t new_cap = list->cap ? list->cap * 2 : 16;
+    while (new_cap < list->len + extra) {
+        new_cap *= 2;
+    }
+    unsigned char *bytes = (unsigned char *)realloc(list->bytes, new_cap);
+    if (!bytes) {
+        fprintf(stderr, "Error: Memory allocation failed for posting list.\n");
+        return 0;
+    }
+    list->bytes = bytes;
+    list->cap = new_cap;
+    return 1;
+}
+
+/**
+ * Appends a varint encoded delta to the end of a posting list.
+ *
+ * @param list Pointer to the posting list.
+ * @param delta The (positive) gap to the previous id.
+ * @return 1 on success, 0 on allocation failure.
+ */
+static int posting_list_append_delta(t_posting_list *list, unsigned int delta) {
+    if (!posting_list_reserve(list, 5)) {
+        return 0;
+    }
+    list->len += encode_varint(list->bytes + list->len, delta);
+    return 1;
+}
+
+/**
+ * Replaces len bytes at pos with the given bytes, moving the rest of the list.
+ *
+ * @param list Pointer to the posting list.
+ * @param pos Offset of the bytes to replace.
+ * @param len Number of bytes replaced.
+ * @param with The replacement bytes.
+ * @param with_len Number of replacement bytes.
+ * @return 1 on success, 0 on allocation failure.
+ */
+static int posting_list_splice(t_posting_list *list, size_t pos, size_t len, const unsigned char *with, size_t with_len) {
+    if (with_len > len && !posting_list_reserve(list, with_len - len)) {
+        return 0;
+    }
+    memmove(list->bytes + pos + with_len, list->bytes + pos + len, list->len - pos - len);
+    memcpy(list->bytes + pos, with, with_len);
+    list->len = list->len - len + with_len;
+    return 1;
+}
+
+/**
+ * Advances a cursor to the next id of its posting list.
+ *
+ * @param cursor Pointer to the cursor.
+ * @return 1 if the cursor moved to a new id, 0 at the end of the list.
+ */
+static int cursor_next(t_posting_cursor *cursor) {
+    if (cursor->pos >= cursor->end) {
+        return 0;
+    }
+    unsigned int delta = 0;
+    int shift = 0;
+    while (cursor->pos < cursor->end) {
+        unsigned char byte = *cursor->pos++;
+        delta |= (unsigned int)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            break;
+        }
+        shift += 7;
+    }
+    cursor->id += (int)delta;
+    return 1;
+}
+
+static void cursor_init(t_posting_cursor *cursor, const t_posting_list *list) {
+    cursor->pos = list->bytes;
+    cursor->end = list->bytes + list->len;
+    cursor->id = -1;
+}
+
+/**
+ * Decodes a posting list into an array of ids.
+ *
+ * @param list Pointer to the posting list.
+ * @param ids Array with room for list->count ids.
+ * @return The number of ids written.
+ */
+int posting_list_decode(const t_posting_list *list, int *ids) {
+    t_posting_cursor cursor;
+    cursor_init(&cursor, list);
+    int n = 0;
+    while (cursor_next(&cursor)) {
+        ids[n++] = cursor.id;
+    }
+    return n;
+}
+
+/**
+ * Merges sorted ids into a posting list in one pass, so a batch costs one
+ * walk of the list however its ids interleave with the ones already there.
+ *
+ * @param list Pointer to the posting list.
+ * @param ids Ids in ascending order; duplicates and ids already present are skipped.
+ * @param n Number of ids.
+ * @return The number of ids added, or -1 on allocation failure.
+ */
+int posting_list_merge(t_posting_list *list, const int *ids, int n) {
+    int start = 0;
+    while (start < n && ids[start] < 0) start++;
+    if (start == n) {
+        return 0;
+    }
+    int before = list->count;
+    if (ids[start] > list->last_id) {
+        // Entirely past the end: append
+        for (int i = start; i < n; i++) {
+            if (ids[i] > list->last_id && !posting_list_add(list, ids[i])) return -1;
+        }
+        return list->count - before;
+    }
+
+    t_posting_list merged;
+    posting_list_init(&merged);
+    t_posting_cursor cursor;
+    cursor_init(&cursor, list);
+    bool more = cursor_next(&cursor);
+    int i = start;
+    while (more || i < n) {
+        int id;
+        if (!more || (i < n && ids[i] < cursor.id)) {
+            id = ids[i++];
+        } else {
+            id = cursor.id;
+            more = cursor_next(&cursor);
+        }
+        if (id <= merged.last_id) continue;
+        if (!posting_list_append_delta(&merged, (unsigned int)(id - merged.last_id))) {
+            posting_list_free(&merged);
+            return -1;
+        }
+        merged.last_id = id;
+        merged.count++;
+    }
+    posting_list_free(list);
+    *list = merged;
+    return list->count - before;
+}
+
+/**
+ * Adds an id to a posting list, keeping it sorted and free of duplicates.
+ * Ids arriving in ascending order (the common case) are appended in place.
+ *
+ * @param list Pointer to the posting list.
+ * @param id The message id to add (must be non-negative).
+ * @return 1 if the id was added, 0 if it was already present or on failure.
+ */
+int posting_list_add(t_posting_list *list, int id) {
+    if (id < 0) {
+        return 0;
+    }
+    if (id > list->last_id) {
+        if (!posting_list_append_delta(list, (unsigned int)(id - list->last_id))) {
+            return 0;
+        }
+        list->last_id = id;
+        list->count++;
+        return 1;
+    }
+
+    // Out of order insert: find the id that follows it and split that id's delta in two
+    t_posting_cursor cursor;
+    cursor_init(&cursor, list);
+    const unsigned char *at = cursor.pos;
+    int prev = -1;
+    while (cursor_next(&cursor) && cursor.id < id) {
+        prev = cursor.id;
+        at = cursor.pos;
+    }
+    if (cursor.id == id) {
+        return 0;
+    }
+    unsigned char with[10];
+    int with_len = encode_varint(with, (unsigned int)(id - prev));
+    with_len += encode_varint(with + with_len, (unsigned int)(cursor.id - id));
+    size_t pos = at - list->bytes;
+    if (!posting_list_splice(list, pos, cursor.pos - at, with, with_len)) {
+        return 0;
+    }
+    list->count++;
+    return 1;
+}
+
+/**
+ * Removes an id from a posting list.
+ *
+ * @param list Pointer to the posting list.
+ * @param id The message id to remove.
+ * @return 1 if the id was removed, 0 if it was not present or on failure.
+ */
+int posting_list_remove(t_posting_list *list, int id) {
+    if (list->count == 0 || id < 0 || id > list->last_id) {
+        return 0;
+    }
+    t_posting_cursor cursor;
+    cursor_init(&cursor, list);
+    const unsigned char *at = cursor.pos;
+    int prev = -1;
+    while (cursor_next(&cursor) && cursor.id < id) {
+        prev = cursor.id;
+        at = cursor.pos;
+    }
+    if (cursor.id != id) {
+        return 0;
+    }
+    size_t pos = at - list->bytes;
+    if (cursor.pos == cursor.end) {
+        // Last id: drop its delta
+        list->len = pos;
+        list->last_id = prev;
+        list->count--;
+        return 1;
+    }
+
+    // Merge the deltas on either side of the id into one
+    cursor_next(&cursor);
+    unsigned char with[5];
+    int with_len = encode_varint(with, (unsigned int)(cursor.id - prev));
+    if (!posting_list_splice(list, pos, cursor.pos - at, with, with_len)) {
+        return 0;
+    }
+    list->count--;
+    return 1;
+}
+
+/**
+ * Adds a message to the sender, receiver and delivery indexes. Until the
+ * indexes are loaded this does nothing: the first query builds them from the
+ * store, which already holds the message.
+ *
+ * @param msg Pointer to the message.
+ */
+void msg_index_add(const t_message *msg) {
+    if (!msg || msg->identifier < 0) return;
+
+    pthread_mutex_lock(&index_lock);
+    if (index_loaded) {
+        t_index_term *sender = intern_lookup(msg->sender, true);
+        t_index_term *receiver = intern_lookup(msg->receiver, true);
+        if (sender && receiver) {
+            posting_list_add(&all_ids, msg->identifier);
+            posting_list_add(&sender->as_sender, msg->identifier);
+            posting_list_add(&receiver->as_receiver, msg->identifier);
+            posting_list_add(&delivered_ids[msg->delivered ? 1 : 0], msg->identifier);
+        }
+    }
+    pthread_mutex_unlock(&index_lock);
+}
+
+/**
+ * @brief one id bound for one posting list, sorted to group a batch by list
+ */
+typedef struct t_pending_id {
+    t_posting_list *list;
+    int id;
+} t_pending_id;
+
+static int compare_pending_id(const void *a, const void *b) {
+    const t_pending_id *x = (const t_pending_id *)a;
+    const t_pending_id *y = (const t_pending_id *)b;
+    if (x->list != y->list) return x->list < y->list ? -1 : 1;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/**
+ * Adds a batch of messages to the indexes. The ids are sorted and each
+ * posting list they touch is merged once, instead of once per message.
+ *
+ * @param msgs Array of messages, in any order.
+ * @param results Per message, as store_insert_batch fills it: only messages with 1 are indexed. NULL indexes all.
+ * @param count Number of messages.
+ */
+void msg_index_add_batch(const t_message *msgs, const int *results, int count) {
+    if (count <= 0) return;
+    pthread_mutex_lock(&index_lock);
+    if (!index_loaded) {
+        pthread_mutex_unlock(&index_lock);
+        return;
+    }
+
+    t_pending_id *pending = (t_pending_id *)malloc(sizeof(t_pending_id) * 4 * count);
+    if (!pending) {
+        fprintf(stderr, "Error: Memory allocation failed for index batch.\n");
+        pthread_mutex_unlock(&index_lock);
+        return;
+    }
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        if ((results && results[i] != 1) || msgs[i].identifier < 0) continue;
+        t_index_term *sender = intern_lookup(msgs[i].sender, true);
+        t_index_term *receiver = intern_lookup(msgs[i].receiver, true);
+        if (!sender || !receiver) continue;
+        pending[n++] = (t_pending_id){ &all_ids, msgs[i].identifier };
+        pending[n++] = (t_pending_id){ &sender->as_sender, msgs[i].identifier };
+        pending[n++] = (t_pending_id){ &receiver->as_receiver, msgs[i].identifier };
+        pending[n++] = (t_pending_id){ &delivered_ids[msgs[i].delivered ? 1 : 0], msgs[i].identifier };
+    }
+    qsort(pending, n, sizeof(t_pending_id), compare_pending_id);
+
+    int *ids = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+    if (!ids) {
+        fprintf(stderr, "Error: Memory allocation failed for index batch.\n");
+        free(pending);
+        pthread_mutex_unlock(&index_lock);
+        return;
+    }
+    for (int start = 0; start < n;) {
+        int end = start;
+        while (end < n && pending[end].list == pending[start].list) {
+            ids[end - start] = pending[end].id;
+            end++;
+        }
+        posting_list_merge(pending[start].list, ids, end - start);
+        start = end;
+    }
+    free(ids);
+    free(pending);
+    pthread_mutex_unlock(&index_lock);
+}
+
+/**
+ * Removes a message from the sender, receiver and delivery indexes.
+ *
+ * @param msg Pointer to the message, as it was when it was indexed.
+ */
+void msg_index_remove(const t_message *msg) {
+    if (!msg || msg->identifier < 0) return;
+
+    pthread_mutex_lock(&index_lock);
+    if (index_loaded) {
+        t_index_term *sender = intern_lookup(msg->sender, false);
+        t_index_term *receiver = intern_lookup(msg->receiver, false);
+
+        posting_list_remove(&all_ids, msg->identifier);
+        if (sender) posting_list_remove(&sender->as_sender, msg->identifier);
+        if (receiver) posting_list_remove(&receiver->as_receiver, msg->identifier);
+        posting_list_remove(&delivered_ids[msg->delivered ? 1 : 0], msg->identifier);
+    }
+    pthread_mutex_unlock(&index_lock);
+}
+
+/**
+ * Moves an indexed message between the delivered and undelivered lists.
+ *
+ * @param identifier The unique identifier of the message.
+ * @param delivered Its new delivery state.
+ */
+void msg_index_set_delivered(int identifier, int delivered) {
+    pthread_mutex_lock(&index_lock);
+    if (index_loaded && posting_list_remove(&delivered_ids[delivered ? 0 : 1], identifier)) {
+        posting_list_add(&delivered_ids[delivered ? 1 : 0], identifier);
+    }
+    pthread_mutex_unlock(&index_lock);
+}
+
+static void index_visitor(const t_message *msg, long offset, void *arg) {
+    msg_index_add(msg);
+}
+
+/**
+ * Builds the indexes from the live messages of the message store. The store
+ * visits them in id order, so every posting list is built by appending.
+ * The indexes are marked loaded before the walk, so a message stored while
+ * it waits for the store is indexed by store_msg; adding it twice is harmless.
+ *
+ * @return The number of messages indexed, or -1 if the store could not be read (the indexes are left unloaded).
+ */
+int msg_index_build(void) {
+    pthread_mutex_lock(&index_lock);
+    index_loaded = true;
+    pthread_mutex_unlock(&index_lock);
+
+    int indexed = store_foreach(index_visitor, NULL);
+    if (indexed < 0) {
+        msg_index_reset();
+    }
+    return indexed;
+}
+
+/**
+ * Drops every interned string and posting list.
+ */
+void msg_index_reset(void) {
+    pthread_mutex_lock(&index_lock);
+    for (int i = 0; i < INTERN_TABLE_SIZE; i++) {
+        t_index_term *term = intern_table[i];
+        while (term) {
+            t_index_term *next = term->next;
+            posting_list_free(&term->as_sender);
+            posting_list_free(&term->as_receiver);
+            free(term->str);
+            free(term);
+            term = next;
+        }
+        intern_table[i] = NULL;
+    }
+    posting_list_free(&all_ids);
+    posting_list_free(&delivered_ids[0]);
+    posting_list_free(&delivered_ids[1]);
+    index_loaded = false;
+    pthread_mutex_unlock(&index_lock);
+}
+
+/**
+ * Intersects the posting lists of a query. Called with index_lock held.
+ *
+ * @param query Pointer to the query.
+ * @param ids Set to a newly allocated array of matching ids, or NULL if none.
+ * @return The number of matching ids, or -1 on failure.
+ */
+static int query_locked(const t_msg_query *query, int **ids) {
+    const t_posting_list *lists[MAX_QUERY_LISTS];
+    int list_count = 0;
+
+    if (query->sender) {
+        t_index_term *term = intern_lookup(query->sender, false);
+        if (!term) return 0;
+        lists[list_count++] = &term->as_sender;
+    }
+    if (query->receiver) {
+        t_index_term *term = intern_lookup(query->receiver, false);
+        if (!term) return 0;
+        lists[list_count++] = &term->as_receiver;
+    }
+    if (query->delivered == 0 || query->delivered == 1) {
+        lists[list_count++] = &delivered_ids[query->delivered];
+    }
+    if (list_count == 0) {
+        lists[list_count++] = &all_ids;
+    }
+
+    // Drive the intersection from the shortest list
+    int smallest = 0;
+    for (int i = 1; i < list_count; i++) {
+        if (lists[i]->count < lists[smallest]->count) {
+            smallest = i;
+        }
+    }
+    if (lists[smallest]->count == 0) {
+        return 0;
+    }
+
+    int *result = (int *)malloc(lists[smallest]->count * sizeof(int));
+    if (!result) {
+        fprintf(stderr, "Error: Memory allocation failed for query result.\n");
+        return -1;
+    }
+
+    t_posting_cursor cursors[MAX_QUERY_LISTS];
+    for (int i = 0; i < list_count; i++) {
+        cursor_init(&cursors[i], lists[i]);
+    }
+
+    int n = 0;
+    while (cursor_next(&cursors[smallest])) {
+        int candidate = cursors[smallest].id;
+        bool match = true;
+        bool exhausted = false;
+        for (int i = 0; i < list_count && match; i++) {
+            if (i == smallest) continue;
+            while (cursors[i].id < candidate) {
+                if (!cursor_next(&cursors[i])) {
+                    exhausted = true;
+                    break;
+                }
+            }
+            if (exhausted || cursors[i].id != candidate) {
+                match = false;
+            }
+        }
+        if (exhausted) break;
+        if (match) {
+            result[n++] = candidate;
+        }
+    }
+
+    if (n == 0) {
+        free(result);
+        return 0;
+    }
+    *ids = result;
+    return n;
+}
+
+/**
+ * Finds the ids of every message matching a query, intersecting the posting
+ * lists of all its predicates. The indexes are built from the message store
+ * on first use. Safe to call while other threads store messages.
+ *
+ * @param query Pointer to the query.
+ * @param ids Set to a newly allocated array of matching ids in ascending order (NULL if none). The caller is responsible for freeing it.
+ * @return The number of matching ids, or -1 on failure.
+ */
+int msg_index_query(const t_msg_query *query, int **ids) {
+    *ids = NULL;
+    pthread_mutex_lock(&index_lock);
+    if (!index_loaded) {
+        // Building walks the store under store_lock, which must not be taken after index_lock
+        pthread_mutex_unlock(&index_lock);
+        if (msg_index_build() < 0) {
+            return -1;
+        }
+        pthread_mutex_lock(&index_lock);
+    }
+    int n = query_locked(query, ids);
+    pthread_mutex_unlock(&index_lock);
+    return n;
+}
+
+/**
+ * Streams every message matching a query through the cache, in id order.
+ *
+ * @param query Pointer to the query.
+ * @param visitor Function called with the status of each matching message.
+ * @param arg Argument passed through to the visitor.
+ * @param cache_hash_table Array of pointers to cache hash table entries.
+ * @param hash_table_size Size of the hash table.
+ * @param lru_cache Pointer to the LRU cache structure.
+ * @param cache_count Pointer to the current count of cache entries.
+ * @param rep_strategy Replacement strategy for the cache (0: LRU, 1: Random).
+ * @return The number of messages visited, or -1 on failure.
+ */
+int msg_index_stream(const t_msg_query *query, t_msg_visitor visitor, void *arg, t_cache_hash_entry *cache_hash_table[], int hash_table_size, t_lru_cache *lru_cache, int *cache_count, int rep_strategy) {
+    int *ids;
+    int n = msg_index_query(query, &ids);
+    if (n <= 0) {
+        return n;
+    }
+
+    int visited = 0;
+    for (int i = 0; i < n; i++) {
+        t_message_status *status = retrieve_msg(ids[i], cache_hash_table, hash_table_size, lru_cache, cache_count, rep_strategy);
+        if (!status) continue;
+        if (status->hit_status != 3) {
+            visitor(status, arg);
+            visited++;
+        }
+        free(status);
+    }
+    free(ids);
+    return visited;
+}
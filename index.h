@@ -0,0 +1,48 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include "message.h"
+#include "cache.h"
+
+#include <stddef.h>
+
+/**
+ * @brief sorted list of message ids, stored as varint encoded deltas
+ */
+typedef struct t_posting_list {
+    unsigned char *bytes; // delta/varint encoded ids in ascending order
+    size_t len;
+    size_t cap;
+    int count;
+    int last_id;
+} t_posting_list;
+
+/**
+ * @brief secondary index query, NULL strings and delivered == -1 match anything
+ */
+typedef struct t_msg_query {
+    const char *sender;
+    const char *receiver;
+    int delivered; // 0: not delivered, 1: delivered, -1: any
+} t_msg_query;
+
+typedef void (*t_msg_visitor)(const t_message_status *status, void *arg);
+
+void posting_list_init(t_posting_list *list);
+void posting_list_free(t_posting_list *list);
+int posting_list_add(t_posting_list *list, int id);
+int posting_list_merge(t_posting_list *list, const int *ids, int n);
+int posting_list_remove(t_posting_list *list, int id);
+int posting_list_decode(const t_posting_list *list, int *ids);
+
+void msg_index_add(const t_message *msg);
+void msg_index_add_batch(const t_message *msgs, const int *results, int count);
+void msg_index_remove(const t_message *msg);
+void msg_index_set_delivered(int identifier, int delivered);
+int msg_index_build(void);
+void msg_index_reset(void);
+
+int msg_index_query(const t_msg_query *query, int **ids);
+int msg_index_stream(const t_msg_query *query, t_msg_visitor visitor, void *arg, t_cache_hash_entry *cache_hash_table[], int hash_table_size, t_lru_cache *lru_cache, int *cache_count, int rep_strategy);
+
+#endif // INDEX_H
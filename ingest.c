@@ -0,0 +1,177 @@
+#include "ingest.h"
+#include "store.h"
+#include "msg_scan.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#define INGEST_LINE_SIZE STORE_RECORD_SIZE
+
+
+/**
+ * Starts a bulk load into the message store.
+ *
+ * @return Pointer to the load, or NULL on failure. Finish it with ingest_end.
+ */
+t_ingest* ingest_begin(void) {
+    t_ingest *ingest = (t_ingest *)calloc(1, sizeof(t_ingest));
+    if (ingest) {
+        ingest->batch = (t_message *)malloc(sizeof(t_message) * INGEST_BATCH_SIZE);
+        ingest->results = (int *)malloc(sizeof(int) * INGEST_BATCH_SIZE);
+    }
+    if (!ingest || !ingest->batch || !ingest->results) {
+        fprintf(stderr, "Error: Memory allocation failed for t_ingest.\n");
+        if (ingest) {
+            free(ingest->batch);
+            free(ingest->results);
+            free(ingest);
+        }
+        return NULL;
+    }
+    return ingest;
+}
+
+/**
+ * Asks a load to leave its most recently stored messages in a cache when it ends.
+ *
+ * @param ingest Pointer to the load.
+ * @param cache_hash_table Array of pointers to cache hash table entries.
+ * @param hash_table_size Size of the hash table.
+ * @param lru_cache Pointer to the LRU cache structure.
+ * @param cache_count Pointer to the current count of cache entries.
+ * @param rep_strategy Replacement strategy for the cache (0: LRU, 1: Random).
+ */
+void ingest_prime_cache(t_ingest *ingest, t_cache_hash_entry *cache_hash_table[], int hash_table_size, t_lru_cache *lru_cache, int *cache_count, int rep_strategy) {
+    ingest->cache_hash_table = cache_hash_table;
+    ingest->hash_table_size = hash_table_size;
+    ingest->lru_cache = lru_cache;
+    ingest->cache_count = cache_count;
+    ingest->rep_strategy = rep_strategy;
+}
+
+/**
+ * Writes the buffered messages to the store in one batch.
+ *
+ * @param ingest Pointer to the load.
+ * @return 0 on success, -1 if the store could not be written.
+ */
+int ingest_flush(t_ingest *ingest) {
+    if (ingest->count == 0) return 0;
+    int appended = store_insert_batch(ingest->batch, ingest->count, ingest->results);
+
+    for (int i = 0; i < ingest->count; i++) {
+        if (ingest->results[i] == 1) {
+            ingest->stats.stored++;
+            if (ingest->cache_hash_table) {
+                ingest->recent[ingest->recent_next] = ingest->batch[i];
+                ingest->recent_next = (ingest->recent_next + 1) % CACHE_SIZE;
+                if (ingest->recent_count < CACHE_SIZE) ingest->recent_count++;
+            }
+        } else if (ingest->results[i] == 0) {
+            ingest->stats.duplicates++;
+        } else {
+            ingest->stats.rejected++;
+        }
+    }
+    ingest->count = 0;
+    return appended < 0 ? -1 : 0;
+}
+
+/**
+ * Adds one message to a load. It is copied, so the caller keeps ownership.
+ *
+ * @param ingest Pointer to the load.
+ * @param msg Pointer to the message.
+ * @return 0 if the message was accepted, 1 if it was rejected, -1 if a batch could not be written.
+ */
+int ingest_add(t_ingest *ingest, const t_message *msg) {
+    ingest->stats.received++;
+    if (!scan_msg_storable(msg)) {
+        ingest->stats.rejected++;
+        return 1;
+    }
+    ingest->batch[ingest->count++] = *msg;
+    return ingest->count == INGEST_BATCH_SIZE ? ingest_flush(ingest) : 0;
+}
+
+/**
+ * Adds one line in the message file format to a load. Blank lines are skipped.
+ *
+ * @param ingest Pointer to the load.
+ * @param line The line, with or without its newline.
+ * @return 0 if the message was accepted or the line was blank, 1 if it was rejected, -1 if a batch could not be written.
+ */
+int ingest_add_line(t_ingest *ingest, const char *line) {
+    const char *p = line;
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '\0') return 0;
+
+    t_message msg;
+    if (*p == STORE_TOMBSTONE || !parse_msg_line(p, &msg)) {
+        ingest->stats.received++;
+        ingest->stats.rejected++;
+        return 1;
+    }
+    return ingest_add(ingest, &msg);
+}
+
+/**
+ * Finishes a load: writes what is still buffered, primes the cache if asked
+ * to, and frees the load.
+ *
+ * @param ingest Pointer to the load.
+ * @param stats Filled in with the load's counters, may be NULL.
+ * @return 0 on success, -1 if the last batch could not be written.
+ */
+int ingest_end(t_ingest *ingest, t_ingest_stats *stats) {
+    int rc = ingest_flush(ingest);
+
+    // Oldest first, so the last message stored ends up most recently used
+    int first = ingest->recent_count < CACHE_SIZE ? 0 : ingest->recent_next;
+    for (int i = 0; i < ingest->recent_count; i++) {
+        const t_message *msg = &ingest->recent[(first + i) % CACHE_SIZE];
+        cache_msg(msg, ingest->cache_hash_table, ingest->hash_table_size, ingest->lru_cache, ingest->cache_count, ingest->rep_strategy);
+    }
+
+    if (stats) *stats = ingest->stats;
+    free(ingest->batch);
+    free(ingest->results);
+    free(ingest);
+    return rc;
+}
+
+/**
+ * Loads every message in a stream of message file lines into the store.
+ *
+ * @param in The stream to read.
+ * @param stats Filled in with the load's counters, may be NULL.
+ * @return 0 on success, -1 on failure.
+ */
+int ingest_file(FILE *in, t_ingest_stats *stats) {
+    t_ingest *ingest = ingest_begin();
+    if (!ingest) return -1;
+
+    char line[INGEST_LINE_SIZE];
+    int rc = 0;
+    while (rc >= 0 && fgets(line, sizeof(line), in)) {
+        size_t length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            // Longer than any record: reject it and skip the rest of the line
+            int c;
+            while ((c = fgetc(in)) != EOF && c != '\n') {}
+            ingest->stats.received++;
+            ingest->stats.rejected++;
+            continue;
+        }
+        rc = ingest_add_line(ingest, line);
+    }
+    if (ferror(in)) {
+        perror("Error reading messages");
+        rc = -1;
+    }
+    return ingest_end(ingest, stats) != 0 || rc < 0 ? -1 : 0;
+}
@@ -0,0 +1,50 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include "message.h"
+#include "cache.h"
+
+#include <stdio.h>
+
+#define INGEST_BATCH_SIZE 4096
+
+/**
+ * @brief outcome counters of a bulk load
+ */
+typedef struct t_ingest_stats {
+    long received; // messages and lines handed to the loader
+    long stored; // appended to the store
+    long duplicates; // already in the store, or repeated within the load
+    long rejected; // failed validation or could not be encoded
+} t_ingest_stats;
+
+/**
+ * @brief a bulk load in progress: messages are validated as they arrive and
+ * written to the store a batch at a time
+ */
+typedef struct t_ingest {
+    t_message *batch;
+    int count;
+    int *results;
+    t_ingest_stats stats;
+    // Cache to prime with the most recently stored messages, if any
+    t_cache_hash_entry **cache_hash_table;
+    int hash_table_size;
+    t_lru_cache *lru_cache;
+    int *cache_count;
+    int rep_strategy;
+    t_message recent[CACHE_SIZE];
+    int recent_count;
+    int recent_next;
+} t_ingest;
+
+t_ingest* ingest_begin(void);
+void ingest_prime_cache(t_ingest *ingest, t_cache_hash_entry *cache_hash_table[], int hash_table_size, t_lru_cache *lru_cache, int *cache_count, int rep_strategy);
+int ingest_add(t_ingest *ingest, const t_message *msg);
+int ingest_add_line(t_ingest *ingest, const char *line);
+int ingest_flush(t_ingest *ingest);
+int ingest_end(t_ingest *ingest, t_ingest_stats *stats);
+
+int ingest_file(FILE *in, t_ingest_stats *stats);
+
+#endif // INGEST_H
@@ -0,0 +1,42 @@
+#include "ingest.h"
+#include "store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+int main(int argc, char *argv[]) {
+    // Check command-line arguments first
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: msg_loader <input file | -> [message file]\n");
+        return EXIT_FAILURE;
+    }
+
+    FILE *in = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+    if (in == NULL) {
+        perror("Error opening input file");
+        return EXIT_FAILURE;
+    }
+
+    const char *store_path = argc == 3 ? argv[2] : MESSAGE_STORE_FILE;
+    if (store_open(store_path) != 0) {
+        if (in != stdin) fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    t_ingest_stats stats;
+    int rc = ingest_file(in, &stats);
+    store_close();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (in != stdin) fclose(in);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Loaded %ld of %ld messages into %s (%ld duplicates, %ld rejected) in %.3f s, %.0f messages/s\n",
+           stats.stored, stats.received, store_path, stats.duplicates, stats.rejected,
+           seconds, seconds > 0 ? stats.received / seconds : 0.0);
+    return rc == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
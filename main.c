@@ -1,6 +1,9 @@
 #include "message.h"
 #include "cache.h"
 #include "utility.h"
+#include "timesource.h"
+#include "store.h"
+#include "prefetch.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -82,10 +85,12 @@ int main(int argc, char *argv[]) {
         cache_hash_table[i] = NULL;
     }
 
+    // Simulated time: each timestamp read is one millisecond after the last, so no sleeping is needed
+    timesource_use_virtual(TIMESOURCE_SIMULATION_START_MS, 1);
+
     // Generate and store 20 messages
     fprintf(fp_100_msg, "Generating and Storing 100 Messages...\n");
     for (int i = 0; i < 100; i++) {
-        usleep(1000);  // Sleep for a short time (optional)
         char* content = generate_random_number_string(); // Generate a random string
         t_message* msg = create_msg(i, "Sender", "Receiver", content, 0, CONTEXT_SIZE); // Create a message
         if (msg) {
@@ -110,6 +115,7 @@ int main(int argc, char *argv[]) {
             misses_100++;
             fprintf(fp_100_report, "Message ID %d Not Found in Cache - Miss\n", i);
         }
+        free(r_msg);
     }
 
     // Print cache hit/miss statistics for 100 accesses
@@ -118,9 +124,16 @@ int main(int argc, char *argv[]) {
     /***************************************************************************************************************************************************************/
     // Simulate random cache accesses for statistics
     fprintf(fp_1000_report, "Simulating 1000 Random Cache Accesses...\n");
+
+    // Estimate how the hit rate would change with the cache size, without resizing
+    t_sizer_config sizer_config = {
+        .memory_ceiling = 4L * CACHE_SIZE * (sizeof(t_cache_hash_entry) + sizeof(t_lru_node)),
+        .sample_rate = 1.0,
+        .adjust = false,
+    };
+    cache_enable_autosize(&sizer_config);
     int hits = 0, misses = 0;
     for (int i = 0; i < 1000; i++) {
-        usleep(1000); // Sleep for a short time (optional)
         int random_id = rand() % 100; // Generate a random message ID
         t_message_status* status = retrieve_msg(random_id, cache_hash_table, CACHE_SIZE, &lru_cache, &cache_count, replacement_strategy);
         if (status && status->hit_status == 1) {
@@ -130,6 +143,7 @@ int main(int argc, char *argv[]) {
             misses++; // Increment misses
             fprintf(fp_1000_msg, "Message ID %d Not Found in Cache\n", random_id);
         }
+        free(status);
     }
 
     // Print cache hit/miss statistics
@@ -137,6 +151,22 @@ int main(int argc, char *argv[]) {
             (replacement_strategy == 0) ? "LRU" : "Random", hits, misses, 
             (double)hits / (hits + misses) * 100);
 
+    // Print the estimated hit rate curve
+    t_sizer_point curve[8];
+    int points = sizer_get_curve(curve, 8);
+    fprintf(fp_1000_report, "Estimated LRU Hit Rate by Cache Size (current size %d):\n", cache_get_capacity());
+    for (int i = 0; i < points; i++) {
+        fprintf(fp_1000_report, "  %4d messages: %6.2f%% (+%.3f%% per extra message)\n", curve[i].capacity, curve[i].hit_ratio * 100, curve[i].marginal * 100);
+    }
+    cache_disable_autosize();
+
+    // Print read-ahead statistics
+    t_prefetch_stats prefetch_stats;
+    prefetch_get_stats(&prefetch_stats);
+    fprintf(fp_1000_report, "Prefetch - Issued: %ld, Used: %ld, Wasted: %ld, Accuracy: %.2f%%\n",
+            prefetch_stats.issued, prefetch_stats.used, prefetch_stats.wasted,
+            prefetch_stats.issued ? (double)prefetch_stats.used / prefetch_stats.issued * 100 : 0.0);
+
     // Clean up the cache and free resources
     for (int i = 0; i < CACHE_SIZE; i++) {
         t_cache_hash_entry *current_entry = cache_hash_table[i];
@@ -147,7 +177,8 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    // Close files at the end
+    // Close the message store and files at the end
+    store_close();
     fclose(fp_100_report);
     fclose(fp_1000_report);
     fclose(fp_100_msg);
@@ -1,5 +1,6 @@
 #include "message.h"
 #include "utility.h"
+#include "msg_scan.h"
 
 
 #include <stdlib.h>
@@ -48,3 +49,50 @@ t_message* create_msg(int unique_id, const char* sender, const char* receiver, c
     return msg;
 }
 
+
+/**
+ * Parse one line of the message store into a message object.
+ * 
+ * @param line The line read from the message store file.
+ * @param msg Pointer to the message to fill in.
+ * @return 1 if the line holds a complete message, 0 otherwise.
+ */
+int parse_msg_line(const char* line, t_message* msg) {
+    return scan_msg_line(line, line + strlen(line), msg);
+}
+
+
+/**
+ * Parse one line of the message store with sscanf. This was the parser before
+ * scan_msg_line; it is kept as the reference the parser benchmark and tests
+ * compare against. Its field widths match SCAN_MAX_NAME and SCAN_MAX_CONTENT.
+ * 
+ * @param line The line read from the message store file.
+ * @param msg Pointer to the message to fill in.
+ * @return 1 if the line holds a complete message, 0 otherwise.
+ */
+int parse_msg_line_scanf(const char* line, t_message* msg) {
+    long time_sent;
+    if (sscanf(line, "%d %ld %99s %99s %1023s %d", &msg->identifier, &time_sent, msg->sender, msg->receiver, msg->content, &msg->delivered) != 6) {
+        return 0;
+    }
+    msg->time_sent = time_sent;
+    return 1;
+}
+
+
+/**
+ * Format a message as one line of the message store.
+ * 
+ * @param msg Pointer to the message.
+ * @param line Buffer to write the line (including the trailing newline) to.
+ * @param line_size Size of the buffer.
+ * @return The length of the line, or -1 if it does not fit in the buffer.
+ */
+int format_msg_line(const t_message* msg, char* line, int line_size) {
+    int len = snprintf(line, line_size, "%d %ld %s %s %s %d\n", msg->identifier, (long)msg->time_sent, msg->sender, msg->receiver, msg->content, msg->delivered);
+    if (len < 0 || len >= line_size) {
+        return -1;
+    }
+    return len;
+}
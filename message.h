@@ -6,6 +6,7 @@
 
 #define MESSAGE_SIZE 1024
 #define CONTEXT_SIZE 1024
+#define MESSAGE_STORE_FILE "messages.txt"
 
 
 /**
@@ -23,5 +24,8 @@ typedef struct t_message{
 
 // function prototypes
 t_message* create_msg(int identifier, const char* sender, const char* receiver, const char* content, int delivered_flag, int limit_size);
+int parse_msg_line(const char* line, t_message* msg);
+int parse_msg_line_scanf(const char* line, t_message* msg);
+int format_msg_line(const t_message* msg, char* line, int line_size);
 
 #endif // MESSAGE_H
@@ -0,0 +1,418 @@
+#include "message.h"
+#include "cache.h"
+#include "store.h"
+#include "time_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define BENCH_OPS 4096 // operations per repetition, also the number of cached entries
+#define BENCH_TABLE_SIZE 1024 // hash buckets, so chains are four entries long
+#define BENCH_WARMUP_REPS 2
+#define BENCH_DEFAULT_REPS 15
+#define BENCH_STORE_FILE "micro_bench_messages.txt"
+#define LATENCY_STORES 50000 // stores timed one by one, each evicting once the cache is full
+#define LATENCY_CAPACITY 1024
+#define LATENCY_LOW_WATERMARK 64
+#define LATENCY_HIGH_WATERMARK 256
+
+#define COUNTER_CYCLES 0
+#define COUNTER_INSTRUCTIONS 1
+#define COUNTER_L1D_MISSES 2
+#define COUNTER_LLC_MISSES 3
+#define COUNTER_BRANCH_MISSES 4
+#define COUNTER_COUNT 5
+
+/**
+ * @brief one primitive under test. setup and teardown run outside the timed
+ * region, before and after each repetition of BENCH_OPS calls to run.
+ */
+typedef struct t_bench_case {
+    const char *name;
+    void (*setup)(void);
+    void (*run)(int op);
+    void (*teardown)(void);
+} t_bench_case;
+
+/**
+ * @brief summary of one primitive over every measured repetition
+ */
+typedef struct t_bench_result {
+    double min_ns;
+    double median_ns;
+    double mean_ns;
+    double stddev_ns;
+    double counters[COUNTER_COUNT]; // per operation
+} t_bench_result;
+
+static int counter_fds[COUNTER_COUNT];
+static const char *counter_names[COUNTER_COUNT] = { "cycles", "instr", "L1D-miss", "LLC-miss", "br-miss" };
+
+static t_lru_node nodes[BENCH_OPS];
+static t_lru_cache bench_lru;
+static t_cache_hash_entry *bench_table[BENCH_TABLE_SIZE];
+static int bench_count = 0;
+static int order[BENCH_OPS]; // a fixed random permutation of the keys
+static volatile long sink; // keeps lookups from being optimised away
+
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int open_counter(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/**
+ * Opens the hardware counters for this thread. A counter the CPU, kernel or
+ * sandbox does not allow stays closed and is reported as n/a.
+ *
+ * @return Number of counters opened.
+ */
+static int counters_open(void) {
+    counter_fds[COUNTER_CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counter_fds[COUNTER_INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counter_fds[COUNTER_L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+        | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    counter_fds[COUNTER_LLC_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    counter_fds[COUNTER_BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    int opened = 0;
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (counter_fds[c] >= 0) opened++;
+    }
+    return opened;
+}
+
+static void counters_close(void) {
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (counter_fds[c] >= 0) close(counter_fds[c]);
+    }
+}
+
+static void counters_start(void) {
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (counter_fds[c] < 0) continue;
+        ioctl(counter_fds[c], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter_fds[c], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void counters_stop(double *totals) {
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (counter_fds[c] < 0) continue;
+        ioctl(counter_fds[c], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t value = 0;
+        if (read(counter_fds[c], &value, sizeof(value)) == sizeof(value)) totals[c] += value;
+    }
+}
+
+/**
+ * Fills the benchmark cache with BENCH_OPS entries, as cache_msg would.
+ */
+static void fill_cache(void) {
+    bench_lru.head = bench_lru.tail = NULL;
+    memset(bench_table, 0, sizeof(bench_table));
+    bench_count = 0;
+    for (int key = 0; key < BENCH_OPS; key++) {
+        t_cache_hash_entry *entry = (t_cache_hash_entry *)calloc(1, sizeof(t_cache_hash_entry));
+        t_lru_node *node = (t_lru_node *)malloc(sizeof(t_lru_node));
+        if (!entry || !node) {
+            fprintf(stderr, "Error: Memory allocation failed for benchmark cache.\n");
+            exit(EXIT_FAILURE);
+        }
+        entry->key = key;
+        entry->message_with_status.message.identifier = key;
+        entry->lru_node = node;
+        node->key = key;
+        entry->next = bench_table[key % BENCH_TABLE_SIZE];
+        bench_table[key % BENCH_TABLE_SIZE] = entry;
+        add_node_to_lru_head(&bench_lru, node);
+        bench_count++;
+    }
+}
+
+static void empty_cache(void) {
+    for (int i = 0; i < BENCH_TABLE_SIZE; i++) {
+        while (bench_table[i]) {
+            t_cache_hash_entry *next = bench_table[i]->next;
+            free(bench_table[i]->lru_node);
+            free(bench_table[i]);
+            bench_table[i] = next;
+        }
+    }
+    bench_lru.head = bench_lru.tail = NULL;
+    bench_count = 0;
+}
+
+static void reset_list(void) {
+    bench_lru.head = bench_lru.tail = NULL;
+}
+
+static void fill_list(void) {
+    reset_list();
+    for (int i = 0; i < BENCH_OPS; i++) {
+        nodes[i].key = i;
+        add_node_to_lru_head(&bench_lru, &nodes[i]);
+    }
+}
+
+static void nothing(void) {
+}
+
+static void run_add_head(int op) {
+    add_node_to_lru_head(&bench_lru, &nodes[op]);
+}
+
+static void run_move_head(int op) {
+    move_node_to_lru_head(&bench_lru, &nodes[order[op]]);
+}
+
+/**
+ * The chain walk retrieve_msg does to find a cached message.
+ */
+static void run_lookup(int op) {
+    int key = order[op];
+    t_cache_hash_entry *entry = bench_table[key % BENCH_TABLE_SIZE];
+    while (entry && entry->key != key) entry = entry->next;
+    sink += entry ? entry->message_with_status.message.identifier : -1;
+}
+
+static void run_lru_replacement(int op) {
+    lru_replacement(bench_table, BENCH_TABLE_SIZE, &bench_lru, &bench_count);
+}
+
+static void run_random_replacement(int op) {
+    random_replacement(bench_table, BENCH_TABLE_SIZE, &bench_lru, &bench_count);
+}
+
+static void run_disk_read(int op) {
+    t_message msg;
+    sink += store_get(order[op], &msg);
+}
+
+/**
+ * Runs one primitive: warmup repetitions first, then reps measured ones,
+ * each timed as a whole and divided by BENCH_OPS.
+ */
+static void measure(const t_bench_case *bench, int reps, int quiet_fd, t_bench_result *result) {
+    double *per_op = (double *)malloc(reps * sizeof(double));
+    if (!per_op) {
+        fprintf(stderr, "Error: Memory allocation failed for benchmark results.\n");
+        exit(EXIT_FAILURE);
+    }
+    double totals[COUNTER_COUNT] = { 0 };
+    double discard[COUNTER_COUNT] = { 0 };
+
+    // The replacement functions print every eviction; that output goes to /dev/null while timing
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(quiet_fd, STDOUT_FILENO);
+    for (int r = 0; r < BENCH_WARMUP_REPS + reps; r++) {
+        bool warmup = r < BENCH_WARMUP_REPS;
+        bench->setup();
+        counters_start();
+        double start = now_ns();
+        for (int op = 0; op < BENCH_OPS; op++) bench->run(op);
+        double elapsed = now_ns() - start;
+        counters_stop(warmup ? discard : totals);
+        bench->teardown();
+        if (!warmup) per_op[r - BENCH_WARMUP_REPS] = elapsed / BENCH_OPS;
+    }
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    double sum = 0, squares = 0;
+    for (int r = 0; r < reps; r++) sum += per_op[r];
+    result->mean_ns = sum / reps;
+    for (int r = 0; r < reps; r++) squares += (per_op[r] - result->mean_ns) * (per_op[r] - result->mean_ns);
+    result->stddev_ns = reps > 1 ? sqrt(squares / (reps - 1)) : 0;
+    // Insertion sort: reps is small
+    for (int i = 1; i < reps; i++) {
+        double value = per_op[i];
+        int j = i;
+        while (j > 0 && per_op[j - 1] > value) {
+            per_op[j] = per_op[j - 1];
+            j--;
+        }
+        per_op[j] = value;
+    }
+    result->min_ns = per_op[0];
+    result->median_ns = reps % 2 ? per_op[reps / 2] : (per_op[reps / 2 - 1] + per_op[reps / 2]) / 2;
+    for (int c = 0; c < COUNTER_COUNT; c++) result->counters[c] = totals[c] / ((double)reps * BENCH_OPS);
+    free(per_op);
+}
+
+static void print_result(const char *name, const t_bench_result *result) {
+    printf("%-24s %8.1f %8.1f %8.1f %8.1f", name, result->min_ns, result->median_ns, result->mean_ns, result->stddev_ns);
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+        if (counter_fds[c] >= 0) printf(" %9.2f", result->counters[c]);
+        else printf(" %9s", "n/a");
+    }
+    printf("\n");
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Times every cache_msg into a full cache, with evictions done inline or by
+ * the background evictor, and prints the latency percentiles.
+ */
+static void measure_store_latency(bool background, int quiet_fd) {
+    double *latency = (double *)malloc(LATENCY_STORES * sizeof(double));
+    if (!latency) {
+        fprintf(stderr, "Error: Memory allocation failed for benchmark results.\n");
+        return;
+    }
+    t_message msg;
+    memset(&msg, 0, sizeof(msg));
+    snprintf(msg.sender, sizeof(msg.sender), "Sender");
+    snprintf(msg.receiver, sizeof(msg.receiver), "Receiver");
+    snprintf(msg.content, sizeof(msg.content), "Latency");
+
+    fflush(stdout);
+    int saved_stdout = dup(STDOUT_FILENO);
+    dup2(quiet_fd, STDOUT_FILENO);
+    memset(bench_table, 0, sizeof(bench_table));
+    bench_lru.head = bench_lru.tail = NULL;
+    bench_count = 0;
+    cache_resize(LATENCY_CAPACITY, bench_table, BENCH_TABLE_SIZE, &bench_lru, &bench_count, 0);
+    for (int id = 0; id < LATENCY_CAPACITY; id++) {
+        msg.identifier = id;
+        cache_msg(&msg, bench_table, BENCH_TABLE_SIZE, &bench_lru, &bench_count, 0);
+    }
+    if (background) {
+        cache_start_evictor(LATENCY_LOW_WATERMARK, LATENCY_HIGH_WATERMARK, bench_table, BENCH_TABLE_SIZE, &bench_lru, &bench_count, 0);
+    }
+    for (int i = 0; i < LATENCY_STORES; i++) {
+        msg.identifier = LATENCY_CAPACITY + i;
+        double start = now_ns();
+        cache_msg(&msg, bench_table, BENCH_TABLE_SIZE, &bench_lru, &bench_count, 0);
+        latency[i] = now_ns() - start;
+    }
+    t_evictor_stats stats;
+    cache_get_evictor_stats(&stats);
+    cache_stop_evictor();
+    empty_cache();
+    cache_resize(CACHE_SIZE, bench_table, BENCH_TABLE_SIZE, &bench_lru, &bench_count, 0);
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+
+    qsort(latency, LATENCY_STORES, sizeof(double), compare_double);
+    printf("%-24s %8.0f %8.0f %8.0f %8.0f   inline %ld, background %ld\n",
+           background ? "cache_msg, evictor" : "cache_msg, inline",
+           latency[LATENCY_STORES / 2], latency[(int)(LATENCY_STORES * 0.99)], latency[(int)(LATENCY_STORES * 0.999)],
+           latency[LATENCY_STORES - 1], stats.inline_evictions, stats.background_evictions);
+    free(latency);
+}
+
+/**
+ * Writes BENCH_OPS messages to a fresh store, for the disk path.
+ */
+static int prepare_store(void) {
+    remove(BENCH_STORE_FILE);
+    remove(BENCH_STORE_FILE STORE_HINT_SUFFIX);
+    remove(BENCH_STORE_FILE TIME_INDEX_SUFFIX);
+    if (store_open(BENCH_STORE_FILE) != 0) return -1;
+    for (int id = 0; id < BENCH_OPS; id++) {
+        t_message *msg = create_msg(id, "Sender", "Receiver", "Benchmark_content", 0, MESSAGE_SIZE);
+        if (!msg || store_insert(msg) < 0) {
+            free(msg);
+            return -1;
+        }
+        free(msg);
+    }
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    // Check command-line arguments first
+    if (argc > 2) {
+        fprintf(stderr, "Usage: micro_bench [repetitions]\n");
+        return EXIT_FAILURE;
+    }
+    int reps = argc == 2 ? atoi(argv[1]) : BENCH_DEFAULT_REPS;
+    if (reps <= 0) reps = BENCH_DEFAULT_REPS;
+
+    int quiet_fd = open("/dev/null", O_WRONLY);
+    if (quiet_fd < 0) {
+        perror("Error opening /dev/null");
+        return EXIT_FAILURE;
+    }
+    if (prepare_store() != 0) {
+        fprintf(stderr, "Error: Unable to prepare the benchmark store.\n");
+        close(quiet_fd);
+        return EXIT_FAILURE;
+    }
+
+    srand(1);
+    for (int i = 0; i < BENCH_OPS; i++) order[i] = i;
+    for (int i = BENCH_OPS - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+
+    t_bench_case cases[] = {
+        {"add_node_to_lru_head", reset_list, run_add_head, nothing},
+        {"move_node_to_lru_head", fill_list, run_move_head, nothing},
+        {"hash chain lookup", fill_cache, run_lookup, empty_cache},
+        {"lru_replacement", fill_cache, run_lru_replacement, empty_cache},
+        {"random_replacement", fill_cache, run_random_replacement, empty_cache},
+        {"store_get (disk path)", nothing, run_disk_read, nothing},
+        {NULL, NULL, NULL, NULL}  // Sentinel to mark the end of the array
+    };
+
+    int opened = counters_open();
+    printf("%d operations per repetition, %d warmup + %d measured repetitions, %d of %d hardware counters available\n",
+           BENCH_OPS, BENCH_WARMUP_REPS, reps, opened, COUNTER_COUNT);
+    printf("%-24s %8s %8s %8s %8s", "primitive (ns/op)", "min", "median", "mean", "stddev");
+    for (int c = 0; c < COUNTER_COUNT; c++) printf(" %9s", counter_names[c]);
+    printf("\n");
+
+    for (int i = 0; cases[i].name != NULL; i++) {
+        t_bench_result result;
+        measure(&cases[i], reps, quiet_fd, &result);
+        print_result(cases[i].name, &result);
+    }
+
+    printf("\n%d stores into a full cache of %d (ns)\n", LATENCY_STORES, LATENCY_CAPACITY);
+    printf("%-24s %8s %8s %8s %8s   evictions\n", "store latency", "p50", "p99", "p99.9", "max");
+    measure_store_latency(false, quiet_fd);
+    measure_store_latency(true, quiet_fd);
+
+    counters_close();
+    store_close();
+    remove(BENCH_STORE_FILE);
+    remove(BENCH_STORE_FILE STORE_HINT_SUFFIX);
+    remove(BENCH_STORE_FILE TIME_INDEX_SUFFIX);
+    close(quiet_fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,233 @@
+#include "msg_scan.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * @brief where the fields of one message line are, before anything is copied
+ */
+typedef struct t_msg_fields {
+    long identifier;
+    long time_sent;
+    const char *sender;
+    int sender_len;
+    const char *receiver;
+    int receiver_len;
+    const char *content;
+    int content_len;
+    long delivered;
+} t_msg_fields;
+
+
+/**
+ * Tells whether a byte ends a field, as whitespace ends a %s conversion.
+ * NUL counts too, so NUL terminated lines stop at their end.
+ */
+static inline bool is_separator(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r') || c == '\0';
+}
+
+/**
+ * Finds the next newline, sixteen bytes at a time where SSE2 is available.
+ *
+ * @param p Start of the buffer.
+ * @param end End of the buffer.
+ * @return Pointer to the newline, or NULL if there is none before end.
+ */
+const char *scan_find_newline(const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), newline));
+        if (mask) return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end) {
+        if (*p == '\n') return p;
+        p++;
+    }
+    return NULL;
+}
+
+/**
+ * Finds the end of the field starting at p: the first whitespace or NUL byte.
+ * With SSE2, every byte up to 0x20 in a block of sixteen is flagged at once,
+ * and only those candidates are checked one by one.
+ *
+ * @param p Start of the field.
+ * @param end End of the buffer.
+ * @return Pointer to the separator, or end.
+ */
+const char *scan_field_end(const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        // max(byte, 0x20) == 0x20 exactly when byte <= 0x20
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(block, space), space));
+        while (mask) {
+            int i = __builtin_ctz(mask);
+            if (is_separator((unsigned char)p[i])) return p + i;
+            mask &= mask - 1;
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && !is_separator((unsigned char)*p)) p++;
+    return p;
+}
+
+static const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+/**
+ * Reads a whole field as a decimal number, with an optional sign.
+ *
+ * @return 1 on success, 0 if the field is not a number in [min, max].
+ */
+static int scan_number(const char **p, const char *end, long min, long max, long *value) {
+    const char *s = skip_blanks(*p, end);
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        s++;
+    }
+    const char *digits = s;
+    long result = 0;
+    while (s < end && *s >= '0' && *s <= '9') {
+        int digit = *s - '0';
+        if (result > (LONG_MAX - digit) / 10) return 0;
+        result = result * 10 + digit;
+        s++;
+    }
+    if (s == digits || (s < end && !is_separator((unsigned char)*s))) return 0;
+    if (negative) result = -result;
+    if (result < min || result > max) return 0;
+    *value = result;
+    *p = s;
+    return 1;
+}
+
+/**
+ * Finds the next whitespace separated field, of at most max_length bytes.
+ *
+ * @return 1 on success, 0 if the line ends first or the field is too long.
+ */
+static int scan_string(const char **p, const char *end, int max_length, const char **field, int *length) {
+    const char *s = skip_blanks(*p, end);
+    if (s >= end || is_separator((unsigned char)*s)) return 0;
+    const char *field_end = scan_field_end(s, end);
+    if (field_end - s > max_length) return 0;
+    *field = s;
+    *length = (int)(field_end - s);
+    *p = field_end;
+    return 1;
+}
+
+/**
+ * Locates every field of a line, checking the numbers as it goes.
+ */
+static int scan_fields(const char *line, const char *end, t_msg_fields *fields) {
+    const char *p = line;
+    return scan_number(&p, end, INT_MIN, INT_MAX, &fields->identifier)
+        && scan_number(&p, end, LONG_MIN, LONG_MAX, &fields->time_sent)
+        && scan_string(&p, end, SCAN_MAX_NAME, &fields->sender, &fields->sender_len)
+        && scan_string(&p, end, SCAN_MAX_NAME, &fields->receiver, &fields->receiver_len)
+        && scan_string(&p, end, SCAN_MAX_CONTENT, &fields->content, &fields->content_len)
+        && scan_number(&p, end, INT_MIN, INT_MAX, &fields->delivered);
+}
+
+/**
+ * Reads only the leading identifier of a message line, so a scan for one id
+ * can skip every other line without parsing it.
+ *
+ * @param line Start of the line.
+ * @param end End of the line (or of the buffer holding it).
+ * @param identifier Set to the identifier.
+ * @return 1 if the line starts with an identifier, 0 otherwise.
+ */
+int scan_msg_id(const char *line, const char *end, int *identifier) {
+    long value;
+    if (!scan_number(&line, end, INT_MIN, INT_MAX, &value)) return 0;
+    *identifier = (int)value;
+    return 1;
+}
+
+/**
+ * Checks that a line holds a complete message and reads its identifier and
+ * timestamp, without copying the text fields.
+ *
+ * @param line Start of the line.
+ * @param end End of the line (or of the buffer holding it).
+ * @param identifier Set to the identifier.
+ * @param time_sent Set to the timestamp.
+ * @return 1 if the line holds a complete message, 0 otherwise.
+ */
+int scan_msg_header(const char *line, const char *end, int *identifier, long *time_sent) {
+    t_msg_fields fields;
+    if (!scan_fields(line, end, &fields)) return 0;
+    *identifier = (int)fields.identifier;
+    *time_sent = fields.time_sent;
+    return 1;
+}
+
+/**
+ * Parses one message line, as parse_msg_line does. Anything after the
+ * delivery flag (such as the store's checksum) is ignored.
+ *
+ * @param line Start of the line.
+ * @param end End of the line (or of the buffer holding it).
+ * @param msg Pointer to the message to fill in.
+ * @return 1 if the line holds a complete message, 0 otherwise.
+ */
+int scan_msg_line(const char *line, const char *end, t_message *msg) {
+    t_msg_fields fields;
+    if (!scan_fields(line, end, &fields)) return 0;
+    msg->identifier = (int)fields.identifier;
+    msg->time_sent = fields.time_sent;
+    memcpy(msg->sender, fields.sender, fields.sender_len);
+    msg->sender[fields.sender_len] = '\0';
+    memcpy(msg->receiver, fields.receiver, fields.receiver_len);
+    msg->receiver[fields.receiver_len] = '\0';
+    memcpy(msg->content, fields.content, fields.content_len);
+    msg->content[fields.content_len] = '\0';
+    msg->delivered = (int)fields.delivered;
+    return 1;
+}
+
+/**
+ * Tells whether a field can be written as one token of a store line.
+ */
+static bool storable_field(const char *field, size_t max_length) {
+    size_t length = strnlen(field, max_length + 1);
+    if (length == 0 || length > max_length) return false;
+    for (size_t i = 0; i < length; i++) {
+        if (isspace((unsigned char)field[i])) return false;
+    }
+    return true;
+}
+
+/**
+ * Checks that a message would read back from a store line exactly as written.
+ *
+ * @param msg Pointer to the message.
+ * @return 1 if it would, 0 otherwise.
+ */
+int scan_msg_storable(const t_message *msg) {
+    return msg->identifier >= 0
+        && (msg->delivered == 0 || msg->delivered == 1)
+        && storable_field(msg->sender, SCAN_MAX_NAME)
+        && storable_field(msg->receiver, SCAN_MAX_NAME)
+        && storable_field(msg->content, SCAN_MAX_CONTENT);
+}
@@ -0,0 +1,17 @@
+#ifndef MSG_SCAN_H
+#define MSG_SCAN_H
+
+#include "message.h"
+
+#define SCAN_MAX_NAME 99 // widest sender or receiver read back from a line
+#define SCAN_MAX_CONTENT (CONTEXT_SIZE - 1) // widest content read back from a line, all a message holds
+
+const char *scan_find_newline(const char *p, const char *end);
+const char *scan_field_end(const char *p, const char *end);
+
+int scan_msg_id(const char *line, const char *end, int *identifier);
+int scan_msg_header(const char *line, const char *end, int *identifier, long *time_sent);
+int scan_msg_line(const char *line, const char *end, t_message *msg);
+int scan_msg_storable(const t_message *msg);
+
+#endif // MSG_SCAN_H
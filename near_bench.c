@@ -0,0 +1,175 @@
+#include "near_cache.h"
+#include "shm_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#define BENCH_SHM_NAME "/p1_near_bench"
+#define BENCH_KEYS 100000
+#define BENCH_CAPACITY 4096 // shared cache slots, well under the key space
+#define BENCH_DEFAULT_THREADS 8
+#define BENCH_DEFAULT_OPS 200000 // lookups per thread
+#define BENCH_DEFAULT_SKEW 0.99
+
+/**
+ * @brief one worker's share of a run
+ */
+typedef struct t_bench_worker {
+    pthread_t thread;
+    t_shm_cache *cache;
+    unsigned int seed;
+    int ops;
+    unsigned long shared_hits;
+    unsigned long near_hits;
+} t_bench_worker;
+
+static double *zipf_cdf = NULL;
+
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Builds the cumulative distribution of a Zipf law over BENCH_KEYS ranks.
+ *
+ * @param skew The Zipf exponent, larger is more skewed.
+ * @return 0 on success, -1 on failure.
+ */
+static int zipf_init(double skew) {
+    zipf_cdf = (double *)malloc(BENCH_KEYS * sizeof(double));
+    if (!zipf_cdf) return -1;
+    double total = 0;
+    for (int k = 0; k < BENCH_KEYS; k++) total += 1.0 / pow(k + 1, skew);
+    double sum = 0;
+    for (int k = 0; k < BENCH_KEYS; k++) {
+        sum += 1.0 / pow(k + 1, skew) / total;
+        zipf_cdf[k] = sum;
+    }
+    zipf_cdf[BENCH_KEYS - 1] = 1.0;
+    return 0;
+}
+
+/**
+ * Draws a key: the rank found by binary search in the distribution,
+ * scattered so popular keys do not sit next to each other.
+ */
+static int zipf_next(unsigned int *seed) {
+    double u = (double)rand_r(seed) / ((double)RAND_MAX + 1);
+    int lo = 0, hi = BENCH_KEYS - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (zipf_cdf[mid] < u) lo = mid + 1;
+        else hi = mid;
+    }
+    return (int)(((unsigned int)lo * 2654435761u) % BENCH_KEYS);
+}
+
+static void make_message(int identifier, t_message *msg) {
+    memset(msg, 0, sizeof(*msg));
+    msg->identifier = identifier;
+    msg->time_sent = identifier;
+    snprintf(msg->sender, sizeof(msg->sender), "Sender%d", identifier % 50);
+    snprintf(msg->receiver, sizeof(msg->receiver), "Receiver%d", identifier % 70);
+    snprintf(msg->content, sizeof(msg->content), "Content%d", identifier);
+}
+
+/**
+ * Looks keys up; a miss stands for a disk read and puts the message in the shared cache.
+ */
+static void *run_worker(void *arg) {
+    t_bench_worker *worker = (t_bench_worker *)arg;
+    t_message msg;
+    near_cache_clear();
+    for (int i = 0; i < worker->ops; i++) {
+        int id = zipf_next(&worker->seed);
+        if (near_cache_get(worker->cache, id, &msg) == 1) {
+            worker->shared_hits++;
+        } else {
+            make_message(id, &msg);
+            shm_cache_put(worker->cache, &msg);
+        }
+    }
+    t_near_cache_stats stats;
+    near_cache_get_stats(&stats);
+    worker->near_hits = stats.hits;
+    return NULL;
+}
+
+/**
+ * Runs threads workers against the same shared cache and prints their throughput.
+ *
+ * @return Lookups per second.
+ */
+static double run_round(t_shm_cache *cache, int threads, int ops, bool near) {
+    t_bench_worker *workers = (t_bench_worker *)calloc(threads, sizeof(t_bench_worker));
+    if (!workers) return 0;
+    near_cache_enable(near);
+
+    double start = now_seconds();
+    for (int t = 0; t < threads; t++) {
+        workers[t].cache = cache;
+        workers[t].seed = 12345u + t;
+        workers[t].ops = ops;
+        pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+    }
+    unsigned long hits = 0, near_hits = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        hits += workers[t].shared_hits;
+        near_hits += workers[t].near_hits;
+    }
+    double elapsed = now_seconds() - start;
+    double total = (double)threads * ops;
+    printf("%-5s %3d threads %12.0f lookups/s  hit ratio %5.1f%%  near hits %5.1f%%\n",
+           near ? "near" : "plain", threads, total / elapsed, 100.0 * hits / total, 100.0 * near_hits / total);
+    free(workers);
+    return total / elapsed;
+}
+
+
+int main(int argc, char *argv[]) {
+    // Check command-line arguments first
+    if (argc > 4) {
+        fprintf(stderr, "Usage: near_bench [max threads] [lookups per thread] [zipf skew]\n");
+        return EXIT_FAILURE;
+    }
+    int max_threads = argc >= 2 ? atoi(argv[1]) : BENCH_DEFAULT_THREADS;
+    int ops = argc >= 3 ? atoi(argv[2]) : BENCH_DEFAULT_OPS;
+    double skew = argc >= 4 ? atof(argv[3]) : BENCH_DEFAULT_SKEW;
+    if (max_threads <= 0) max_threads = BENCH_DEFAULT_THREADS;
+    if (ops <= 0) ops = BENCH_DEFAULT_OPS;
+    if (skew <= 0) skew = BENCH_DEFAULT_SKEW;
+
+    if (zipf_init(skew) != 0) {
+        fprintf(stderr, "Error: Memory allocation failed for benchmark data.\n");
+        return EXIT_FAILURE;
+    }
+    printf("Zipf skew %.2f over %d keys, shared cache of %d, near cache of %d per thread\n",
+           skew, BENCH_KEYS, BENCH_CAPACITY, NEAR_CACHE_SLOTS);
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double rate[2];
+        for (int near = 0; near <= 1; near++) {
+            // A fresh segment for every round, so neither starts warm
+            shm_cache_unlink(BENCH_SHM_NAME);
+            t_shm_cache *cache = shm_cache_open(BENCH_SHM_NAME, BENCH_CAPACITY);
+            if (!cache) {
+                free(zipf_cdf);
+                return EXIT_FAILURE;
+            }
+            rate[near] = run_round(cache, threads, ops, near);
+            shm_cache_close(cache);
+        }
+        printf("Speedup with near cache at %d threads: %.2fx\n", threads, rate[1] / rate[0]);
+    }
+    shm_cache_unlink(BENCH_SHM_NAME);
+    free(zipf_cdf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+#include "near_cache.h"
+#include "store.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+static bool enabled = false;
+
+// Each thread has its own table, so reading it never takes a lock
+static __thread t_near_entry entries[NEAR_CACHE_SLOTS];
+static __thread t_shm_cache *owner = NULL; // mapping the entries were copied from
+static __thread t_near_cache_stats stats;
+
+
+static t_near_entry *entry_of(int identifier) {
+    return &entries[((unsigned int)identifier * 2654435761u) >> 16 & (NEAR_CACHE_SLOTS - 1)];
+}
+
+/**
+ * Turns the per-thread front cache on or off for every thread. Copies
+ * already held stay valid, they are simply not consulted while it is off.
+ *
+ * @param enable true to consult the front cache before the shared one.
+ */
+void near_cache_enable(bool enable) {
+    __atomic_store_n(&enabled, enable, __ATOMIC_RELAXED);
+}
+
+bool near_cache_enabled(void) {
+    return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+/**
+ * Looks a message up in the calling thread's front cache, then in the shared
+ * cache. A thread's copy is used only while the shared slot it came from has
+ * the same version and the segment the same epoch: any update, eviction or
+ * removal bumps the slot's version, so no other thread has to be told.
+ * Hits served here do not refresh the shared LRU order.
+ *
+ * @param cache Pointer to the mapping.
+ * @param identifier The unique identifier of the message.
+ * @param msg Filled in with a copy of the message on a hit.
+ * @return 1 on a hit, 0 on a miss, -1 on failure.
+ */
+int near_cache_get(t_shm_cache *cache, int identifier, t_message *msg) {
+    if (!near_cache_enabled()) return shm_cache_get(cache, identifier, msg);
+    if (owner != cache) {
+        near_cache_clear();
+        owner = cache;
+    }
+
+    t_near_entry *entry = entry_of(identifier);
+    if (entry->valid && entry->identifier == identifier) {
+        t_shm_slot *slot = &cache->slots[entry->slot];
+        if (__atomic_load_n(&slot->version, __ATOMIC_ACQUIRE) == entry->version
+            && __atomic_load_n(&cache->header->epoch, __ATOMIC_ACQUIRE) == entry->epoch) {
+            *msg = entry->message;
+            stats.hits++;
+            return 1;
+        }
+        entry->valid = false;
+        stats.stale++;
+    } else {
+        stats.misses++;
+    }
+
+    int hit = shm_cache_get_versioned(cache, identifier, msg, &entry->slot, &entry->version, &entry->epoch);
+    if (hit == 1) {
+        entry->identifier = identifier;
+        entry->message = *msg;
+        entry->valid = true;
+    }
+    return hit;
+}
+
+/**
+ * Drops every copy held by the calling thread and resets its counters.
+ */
+void near_cache_clear(void) {
+    for (int i = 0; i < NEAR_CACHE_SLOTS; i++) entries[i].valid = false;
+    memset(&stats, 0, sizeof(stats));
+    owner = NULL;
+}
+
+/**
+ * Reports the calling thread's front cache counters.
+ *
+ * @param out Filled in with the counters.
+ */
+void near_cache_get_stats(t_near_cache_stats *out) {
+    *out = stats;
+}
+
+/**
+ * Retrieve a message like shm_retrieve_msg, going through the calling
+ * thread's front cache first.
+ *
+ * @param cache Pointer to the mapping.
+ * @param identifier The unique identifier of the message to retrieve.
+ * @return Pointer to the message status (1: in cache, 2: on disk, 3: not found), or NULL on failure. The caller is responsible for freeing it.
+ */
+t_message_status* near_retrieve_msg(t_shm_cache *cache, int identifier) {
+    t_message_status* msg_status = (t_message_status*)calloc(1, sizeof(t_message_status));
+    if (!msg_status) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return NULL;
+    }
+
+    int hit = near_cache_get(cache, identifier, &msg_status->message);
+    if (hit == 1) {
+        msg_status->hit_status = 1;
+    } else if (hit == 0 && store_get(identifier, &msg_status->message) == 1) {
+        shm_cache_put(cache, &msg_status->message);
+        msg_status->hit_status = 2;
+    } else if (hit == 0) {
+        msg_status->hit_status = 3;
+    } else {
+        free(msg_status);
+        return NULL;
+    }
+    return msg_status;
+}
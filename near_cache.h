@@ -0,0 +1,39 @@
+#ifndef NEAR_CACHE_H
+#define NEAR_CACHE_H
+
+#include "message.h"
+#include "shm_cache.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NEAR_CACHE_SLOTS 64 // entries per thread, a power of two
+
+/**
+ * @brief one thread's copy of a message read from the shared cache, valid
+ * while the slot it came from keeps the same version
+ */
+typedef struct t_near_entry {
+    int identifier;
+    int32_t slot;
+    uint64_t version;
+    uint64_t epoch;
+    bool valid;
+    t_message message;
+} t_near_entry;
+
+typedef struct t_near_cache_stats {
+    unsigned long hits; // served from the thread's own copy
+    unsigned long misses; // not held by the thread
+    unsigned long stale; // held, but the shared slot changed since
+} t_near_cache_stats;
+
+void near_cache_enable(bool enable);
+bool near_cache_enabled(void);
+int near_cache_get(t_shm_cache *cache, int identifier, t_message *msg);
+void near_cache_clear(void);
+void near_cache_get_stats(t_near_cache_stats *stats);
+
+t_message_status* near_retrieve_msg(t_shm_cache *cache, int identifier);
+
+#endif // NEAR_CACHE_H
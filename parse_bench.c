@@ -0,0 +1,198 @@
+#include "message.h"
+#include "msg_scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BENCH_SYNTHETIC_LINES 200000
+#define BENCH_DEFAULT_ROUNDS 5
+#define BENCH_LINE_SIZE 2048
+
+typedef int (*t_scan_pass)(const char *data, size_t size, int target, long *lines);
+
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * The old read path: each line is copied out, as fgets did, and parsed with sscanf.
+ */
+static int parse_all_scanf(const char *data, size_t size, int target, long *lines) {
+    char line[BENCH_LINE_SIZE];
+    t_message msg;
+    int parsed = 0;
+    const char *p = data, *end = data + size;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        size_t length = (newline ? newline + 1 : end) - p;
+        if (length < sizeof(line)) {
+            memcpy(line, p, length);
+            line[length] = '\0';
+            parsed += parse_msg_line_scanf(line, &msg);
+        }
+        (*lines)++;
+        p += length;
+    }
+    return parsed;
+}
+
+/**
+ * The new read path: lines are parsed in place with scan_msg_line.
+ */
+static int parse_all_scan(const char *data, size_t size, int target, long *lines) {
+    t_message msg;
+    int parsed = 0;
+    const char *p = data, *end = data + size;
+    while (p < end) {
+        const char *newline = scan_find_newline(p, end);
+        const char *line_end = newline ? newline + 1 : end;
+        parsed += scan_msg_line(p, line_end, &msg);
+        (*lines)++;
+        p = line_end;
+    }
+    return parsed;
+}
+
+/**
+ * Looks for one id the old way: parse every line, then compare.
+ */
+static int find_id_scanf(const char *data, size_t size, int target, long *lines) {
+    char line[BENCH_LINE_SIZE];
+    t_message msg;
+    const char *p = data, *end = data + size;
+    while (p < end) {
+        const char *newline = memchr(p, '\n', end - p);
+        size_t length = (newline ? newline + 1 : end) - p;
+        (*lines)++;
+        if (length < sizeof(line)) {
+            memcpy(line, p, length);
+            line[length] = '\0';
+            if (parse_msg_line_scanf(line, &msg) && msg.identifier == target) return 1;
+        }
+        p += length;
+    }
+    return 0;
+}
+
+/**
+ * Looks for one id the new way: compare the leading id, parse only the match.
+ */
+static int find_id_scan(const char *data, size_t size, int target, long *lines) {
+    t_message msg;
+    int id;
+    const char *p = data, *end = data + size;
+    while (p < end) {
+        const char *newline = scan_find_newline(p, end);
+        const char *line_end = newline ? newline + 1 : end;
+        (*lines)++;
+        if (scan_msg_id(p, line_end, &id) && id == target && scan_msg_line(p, line_end, &msg)) return 1;
+        p = line_end;
+    }
+    return 0;
+}
+
+/**
+ * Runs one pass several times and prints its best round.
+ *
+ * @return Seconds taken by the best round.
+ */
+static double run_pass(const char *name, t_scan_pass pass, const char *data, size_t size, int target, int rounds) {
+    double best = 0;
+    long lines = 0;
+    int result = 0;
+    for (int r = 0; r < rounds; r++) {
+        lines = 0;
+        double start = now_seconds();
+        result = pass(data, size, target, &lines);
+        double elapsed = now_seconds() - start;
+        if (r == 0 || elapsed < best) best = elapsed;
+    }
+    printf("%-24s %10ld lines %8.1f MB/s %8.1f ns/line (result %d)\n", name, lines, size / best / 1e6, best * 1e9 / (lines ? lines : 1), result);
+    return best;
+}
+
+/**
+ * Builds a message file image in memory, in the format the store writes.
+ */
+static char *synthesize(size_t *size, int *last_id) {
+    size_t capacity = (size_t)BENCH_SYNTHETIC_LINES * 128;
+    char *data = (char *)malloc(capacity);
+    if (!data) return NULL;
+    size_t used = 0;
+    for (int i = 0; i < BENCH_SYNTHETIC_LINES; i++) {
+        int n = snprintf(data + used, capacity - used, "%d %ld Sender%d Receiver%d %s%d %d ~%08x\n",
+                         i, 1700000000000L + i, i % 50, i % 70, "Message_content_", rand(), i % 2, (unsigned int)rand());
+        if (n < 0 || (size_t)n >= capacity - used) break;
+        used += n;
+    }
+    *size = used;
+    *last_id = BENCH_SYNTHETIC_LINES - 1;
+    return data;
+}
+
+
+int main(int argc, char *argv[]) {
+    // Check command-line arguments first
+    if (argc > 3) {
+        fprintf(stderr, "Usage: parse_bench [message file] [rounds]\n");
+        return EXIT_FAILURE;
+    }
+    int rounds = argc == 3 ? atoi(argv[2]) : BENCH_DEFAULT_ROUNDS;
+    if (rounds <= 0) rounds = BENCH_DEFAULT_ROUNDS;
+
+    char *data = NULL;
+    size_t size = 0;
+    int target = -1;
+    int fd = -1;
+    if (argc >= 2) {
+        fd = open(argv[1], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+            perror("Error opening message file");
+            if (fd >= 0) close(fd);
+            return EXIT_FAILURE;
+        }
+        size = st.st_size;
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("Error mapping message file");
+            close(fd);
+            return EXIT_FAILURE;
+        }
+        // The id to look for is the one on the last line, so every line is visited
+        const char *last = data + size - 1;
+        while (last > data && last[-1] != '\n') last--;
+        if (!scan_msg_id(last, data + size, &target)) target = -1;
+        printf("Scanning %s (%zu bytes), %d rounds\n", argv[1], size, rounds);
+    } else {
+        data = synthesize(&size, &target);
+        if (!data) {
+            fprintf(stderr, "Error: Memory allocation failed for benchmark data.\n");
+            return EXIT_FAILURE;
+        }
+        printf("Scanning %d synthetic records (%zu bytes), %d rounds\n", BENCH_SYNTHETIC_LINES, size, rounds);
+    }
+
+    double old_parse = run_pass("parse, sscanf", parse_all_scanf, data, size, target, rounds);
+    double new_parse = run_pass("parse, scan_msg_line", parse_all_scan, data, size, target, rounds);
+    double old_find = run_pass("find id, sscanf", find_id_scanf, data, size, target, rounds);
+    double new_find = run_pass("find id, scan_msg_id", find_id_scan, data, size, target, rounds);
+    printf("Speedup: parse %.1fx, find id %.1fx\n", old_parse / new_parse, old_find / new_find);
+
+    if (fd >= 0) {
+        munmap(data, size);
+        close(fd);
+    } else {
+        free(data);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+#include "prefetch.h"
+#include "store.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <pthread.h>
+
+/**
+ * @brief one run of disk misses with a constant id stride
+ */
+typedef struct t_prefetch_stream {
+    bool active;
+    int last_id; // last id requested in this stream
+    int stride; // 0 until two misses agree on one
+    int confirmations;
+    int ahead_to; // last id read ahead
+    int depth; // ids read ahead of the last request
+    int used; // outcomes in the current adaptation window
+    int wasted;
+    unsigned long last_touch;
+} t_prefetch_stream;
+
+/**
+ * @brief one prefetched message waiting to be requested
+ */
+typedef struct t_prefetch_slot {
+    bool valid;
+    int id;
+    int stream;
+    t_message message;
+} t_prefetch_slot;
+
+static t_prefetch_stream streams[PREFETCH_STREAMS];
+static t_prefetch_slot buffer[PREFETCH_BUFFER_SIZE];
+static int next_victim = 0; // the buffer is replaced in FIFO order
+static unsigned long touch_clock = 0;
+static t_prefetch_stats counters;
+static pthread_mutex_t prefetch_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Widens the window of a stream whose read-ahead keeps being used and
+ * narrows it when most of it is thrown away.
+ */
+static void adapt_locked(t_prefetch_stream *stream) {
+    if (stream->used + stream->wasted < PREFETCH_ADAPT_WINDOW) return;
+    double accuracy = (double)stream->used / (stream->used + stream->wasted);
+    if (accuracy >= 0.75 && stream->depth < PREFETCH_MAX_DEPTH) {
+        stream->depth *= 2;
+        if (stream->depth > PREFETCH_MAX_DEPTH) stream->depth = PREFETCH_MAX_DEPTH;
+    } else if (accuracy < 0.5 && stream->depth > PREFETCH_MIN_DEPTH) {
+        stream->depth /= 2;
+        if (stream->depth < PREFETCH_MIN_DEPTH) stream->depth = PREFETCH_MIN_DEPTH;
+    }
+    stream->used = stream->wasted = 0;
+}
+
+static int find_slot_locked(int identifier) {
+    for (int i = 0; i < PREFETCH_BUFFER_SIZE; i++) {
+        if (buffer[i].valid && buffer[i].id == identifier) return i;
+    }
+    return -1;
+}
+
+static void insert_locked(int stream, const t_message *msg) {
+    t_prefetch_slot *slot = &buffer[next_victim];
+    next_victim = (next_victim + 1) % PREFETCH_BUFFER_SIZE;
+    if (slot->valid) {
+        counters.wasted++;
+        if (streams[slot->stream].active) {
+            streams[slot->stream].wasted++;
+            adapt_locked(&streams[slot->stream]);
+        }
+    }
+    *slot = (t_prefetch_slot){ .valid = true, .id = msg->identifier, .stream = stream, .message = *msg };
+    counters.issued++;
+}
+
+/**
+ * Reads the next ids of a stream, up to depth strides past its last request,
+ * with one batched store read.
+ */
+static void read_ahead_locked(int s) {
+    t_prefetch_stream *stream = &streams[s];
+    int ids[PREFETCH_MAX_DEPTH];
+    int count = 0;
+    // Streams near either end of the id range stop there instead of wrapping around
+    long long target = (long long)stream->last_id + (long long)stream->depth * stream->stride;
+    if (target < 0) target = 0;
+    if (target > INT_MAX) target = INT_MAX;
+    long long next = stream->ahead_to;
+    // ahead_to trails last_id when the stream was re-established
+    if ((stream->stride > 0) ? next < stream->last_id : next > stream->last_id) next = stream->last_id;
+
+    while (count < PREFETCH_MAX_DEPTH && (stream->stride > 0 ? next + stream->stride <= target : next + stream->stride >= target)) {
+        next += stream->stride;
+        if (find_slot_locked((int)next) < 0) ids[count++] = (int)next;
+    }
+    stream->ahead_to = (int)next;
+    if (count == 0) return;
+
+    t_message msgs[PREFETCH_MAX_DEPTH];
+    bool found[PREFETCH_MAX_DEPTH];
+    store_get_batch(ids, count, msgs, found);
+    counters.triggers++;
+    for (int i = 0; i < count; i++) {
+        if (found[i]) insert_locked(s, &msgs[i]);
+    }
+}
+
+/**
+ * Finds the stream a missed id continues, or starts tracking a new one in
+ * place of the least recently touched.
+ */
+static int match_stream_locked(int identifier) {
+    int candidate = -1, victim = -1;
+    for (int s = 0; s < PREFETCH_STREAMS; s++) {
+        t_prefetch_stream *stream = &streams[s];
+        if (!stream->active) {
+            if (victim < 0 || streams[victim].active) victim = s;
+            continue;
+        }
+        long long delta = (long long)identifier - stream->last_id;
+        if (stream->stride != 0 && delta == stream->stride) {
+            stream->confirmations++;
+            return s;
+        }
+        if (candidate < 0 && delta != 0 && llabs(delta) <= PREFETCH_MAX_STRIDE) {
+            candidate = s;
+        }
+        if (victim < 0 || (streams[victim].active && stream->last_touch < streams[victim].last_touch)) {
+            victim = s;
+        }
+    }
+
+    if (candidate >= 0) {
+        // A new stride for a stream nearby: it must be seen again before it is trusted
+        t_prefetch_stream *stream = &streams[candidate];
+        stream->stride = identifier - stream->last_id;
+        stream->confirmations = 1;
+        stream->ahead_to = identifier;
+        return candidate;
+    }
+
+    streams[victim] = (t_prefetch_stream){ .active = true, .last_id = identifier, .ahead_to = identifier, .depth = PREFETCH_INITIAL_DEPTH };
+    return victim;
+}
+
+/**
+ * Records a request that had to go to disk. Once two misses in a row share a
+ * small id stride, the ids that continue it are loaded into the prefetch
+ * buffer, not the cache, so a wrong guess does not evict anything.
+ *
+ * @param identifier The unique identifier of the message that missed.
+ */
+void prefetch_on_miss(int identifier) {
+    pthread_mutex_lock(&prefetch_lock);
+    int s = match_stream_locked(identifier);
+    t_prefetch_stream *stream = &streams[s];
+    stream->last_id = identifier;
+    stream->last_touch = ++touch_clock;
+    if (stream->stride != 0 && stream->confirmations >= PREFETCH_CONFIRMATIONS) {
+        read_ahead_locked(s);
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+/**
+ * Takes a message out of the prefetch buffer. Consuming the read-ahead keeps
+ * its stream going: once less than half the window is left, more is read.
+ *
+ * @param identifier The unique identifier of the message.
+ * @param msg Filled in with the message when it was prefetched.
+ * @return 1 if the message was in the prefetch buffer, 0 otherwise.
+ */
+int prefetch_take(int identifier, t_message *msg) {
+    pthread_mutex_lock(&prefetch_lock);
+    int i = find_slot_locked(identifier);
+    if (i >= 0) {
+        *msg = buffer[i].message;
+        buffer[i].valid = false;
+        counters.used++;
+
+        int s = buffer[i].stream;
+        t_prefetch_stream *stream = &streams[s];
+        if (stream->active && stream->stride != 0) {
+            stream->used++;
+            adapt_locked(stream);
+            stream->last_id = identifier;
+            stream->last_touch = ++touch_clock;
+            if ((stream->ahead_to - identifier) / stream->stride < (stream->depth + 1) / 2) {
+                read_ahead_locked(s);
+            }
+        }
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+    return i >= 0;
+}
+
+/**
+ * Drops a message from the prefetch buffer, because it was changed or deleted.
+ *
+ * @param identifier The unique identifier of the message.
+ */
+void prefetch_invalidate(int identifier) {
+    pthread_mutex_lock(&prefetch_lock);
+    int i = find_slot_locked(identifier);
+    if (i >= 0) {
+        buffer[i].valid = false;
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+/**
+ * Forgets every stream and prefetched message, and clears the counters.
+ */
+void prefetch_reset(void) {
+    pthread_mutex_lock(&prefetch_lock);
+    memset(streams, 0, sizeof(streams));
+    memset(buffer, 0, sizeof(buffer));
+    memset(&counters, 0, sizeof(counters));
+    next_victim = 0;
+    touch_clock = 0;
+    pthread_mutex_unlock(&prefetch_lock);
+}
+
+/**
+ * Reads the prefetch counters. Accuracy is used / issued.
+ *
+ * @param stats Filled in with the counters.
+ */
+void prefetch_get_stats(t_prefetch_stats *stats) {
+    pthread_mutex_lock(&prefetch_lock);
+    *stats = counters;
+    stats->streams = 0;
+    stats->max_depth = 0;
+    for (int s = 0; s < PREFETCH_STREAMS; s++) {
+        if (!streams[s].active) continue;
+        stats->streams++;
+        if (streams[s].depth > stats->max_depth) stats->max_depth = streams[s].depth;
+    }
+    pthread_mutex_unlock(&prefetch_lock);
+}
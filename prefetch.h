@@ -0,0 +1,33 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include "message.h"
+
+#define PREFETCH_STREAMS 8
+#define PREFETCH_BUFFER_SIZE 64
+#define PREFETCH_MAX_STRIDE 16 // larger id gaps are not treated as a stream
+#define PREFETCH_CONFIRMATIONS 2 // misses with the same stride before reading ahead
+#define PREFETCH_INITIAL_DEPTH 4
+#define PREFETCH_MIN_DEPTH 1
+#define PREFETCH_MAX_DEPTH 32
+#define PREFETCH_ADAPT_WINDOW 16 // outcomes between two depth adjustments
+
+/**
+ * @brief read-ahead counters since the last prefetch_reset
+ */
+typedef struct t_prefetch_stats {
+    long triggers; // read-aheads started
+    long issued; // messages loaded ahead of a request
+    long used; // prefetched messages that were then requested
+    long wasted; // prefetched messages dropped without being requested
+    int streams; // streams currently tracked
+    int max_depth; // deepest read-ahead window among them
+} t_prefetch_stats;
+
+void prefetch_on_miss(int identifier);
+int prefetch_take(int identifier, t_message *msg);
+void prefetch_invalidate(int identifier);
+void prefetch_reset(void);
+void prefetch_get_stats(t_prefetch_stats *stats);
+
+#endif // PREFETCH_H
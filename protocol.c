@@ -0,0 +1,220 @@
+#include "protocol.h"
+#include "message.h"
+#include "cache.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * A message is encoded as
+ *   i32 id | i64 time_sent | u8 delivered | u8 sender_len | sender | u8 receiver_len | receiver | u16 content_len | content
+ */
+
+
+void proto_buffer_init(t_proto_buffer *buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+    buf->pos = 0;
+}
+
+void proto_buffer_free(t_proto_buffer *buf) {
+    free(buf->data);
+    proto_buffer_init(buf);
+}
+
+/**
+ * Makes room for extra bytes at the end of a buffer.
+ *
+ * @param buf Pointer to the buffer.
+ * @param extra Number of bytes needed.
+ * @return 0 on success, -1 on allocation failure.
+ */
+int proto_buffer_reserve(t_proto_buffer *buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) {
+        return 0;
+    }
+    size_t cap = buf->cap ? buf->cap : 4096;
+    while (cap < buf->len + extra) {
+        cap *= 2;
+    }
+    unsigned char *data = (unsigned char *)realloc(buf->data, cap);
+    if (!data) {
+        fprintf(stderr, "Error: Memory allocation failed for protocol buffer.\n");
+        return -1;
+    }
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+/**
+ * Drops bytes from the read position of a buffer, compacting it once everything has been read.
+ *
+ * @param buf Pointer to the buffer.
+ * @param count Number of bytes consumed.
+ */
+void proto_buffer_consume(t_proto_buffer *buf, size_t count) {
+    buf->pos += count;
+    if (buf->pos >= buf->len) {
+        buf->pos = buf->len = 0;
+    } else if (buf->pos > buf->cap / 2) {
+        memmove(buf->data, buf->data + buf->pos, buf->len - buf->pos);
+        buf->len -= buf->pos;
+        buf->pos = 0;
+    }
+}
+
+static int put_bytes(t_proto_buffer *buf, const void *bytes, size_t count) {
+    if (proto_buffer_reserve(buf, count) != 0) return -1;
+    memcpy(buf->data + buf->len, bytes, count);
+    buf->len += count;
+    return 0;
+}
+
+int proto_put_u8(t_proto_buffer *buf, uint8_t value) {
+    return put_bytes(buf, &value, sizeof(value));
+}
+
+int proto_put_u32(t_proto_buffer *buf, uint32_t value) {
+    return put_bytes(buf, &value, sizeof(value));
+}
+
+/**
+ * Encodes a message, with its strings length-prefixed rather than padded.
+ *
+ * @param buf Pointer to the buffer.
+ * @param msg Pointer to the message.
+ * @return 0 on success, -1 on failure.
+ */
+int proto_put_message(t_proto_buffer *buf, const t_message *msg) {
+    int32_t id = msg->identifier;
+    int64_t time_sent = msg->time_sent;
+    uint8_t delivered = msg->delivered ? 1 : 0;
+    uint8_t sender_len = (uint8_t)strnlen(msg->sender, sizeof(msg->sender) - 1);
+    uint8_t receiver_len = (uint8_t)strnlen(msg->receiver, sizeof(msg->receiver) - 1);
+    uint16_t content_len = (uint16_t)strnlen(msg->content, sizeof(msg->content) - 1);
+
+    if (put_bytes(buf, &id, sizeof(id)) != 0
+            || put_bytes(buf, &time_sent, sizeof(time_sent)) != 0
+            || put_bytes(buf, &delivered, sizeof(delivered)) != 0
+            || put_bytes(buf, &sender_len, sizeof(sender_len)) != 0
+            || put_bytes(buf, msg->sender, sender_len) != 0
+            || put_bytes(buf, &receiver_len, sizeof(receiver_len)) != 0
+            || put_bytes(buf, msg->receiver, receiver_len) != 0
+            || put_bytes(buf, &content_len, sizeof(content_len)) != 0
+            || put_bytes(buf, msg->content, content_len) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Starts a frame; its length is filled in by proto_end_frame.
+ *
+ * @param buf Pointer to the buffer.
+ * @param request_id Id echoed back in the response.
+ * @param code Opcode of a request, or status of a response.
+ * @param frame_start Set to the offset of the frame in the buffer.
+ * @return 0 on success, -1 on failure.
+ */
+int proto_begin_frame(t_proto_buffer *buf, uint32_t request_id, uint8_t code, size_t *frame_start) {
+    *frame_start = buf->len;
+    if (proto_put_u32(buf, 0) != 0 || proto_put_u32(buf, request_id) != 0 || proto_put_u8(buf, code) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void proto_end_frame(t_proto_buffer *buf, size_t frame_start) {
+    uint32_t length = (uint32_t)(buf->len - frame_start - sizeof(uint32_t));
+    memcpy(buf->data + frame_start, &length, sizeof(length));
+}
+
+static int get_bytes(const unsigned char **pos, const unsigned char *end, void *bytes, size_t count) {
+    if ((size_t)(end - *pos) < count) return -1;
+    memcpy(bytes, *pos, count);
+    *pos += count;
+    return 0;
+}
+
+int proto_get_u8(const unsigned char **pos, const unsigned char *end, uint8_t *value) {
+    return get_bytes(pos, end, value, sizeof(*value));
+}
+
+int proto_get_u32(const unsigned char **pos, const unsigned char *end, uint32_t *value) {
+    return get_bytes(pos, end, value, sizeof(*value));
+}
+
+/**
+ * Decodes a message.
+ *
+ * @param pos Read position, advanced past the message.
+ * @param end End of the readable bytes.
+ * @param msg Pointer to the message to fill in.
+ * @return 0 on success, -1 if the bytes do not hold a valid message.
+ */
+int proto_get_message(const unsigned char **pos, const unsigned char *end, t_message *msg) {
+    int32_t id;
+    int64_t time_sent;
+    uint8_t delivered, sender_len, receiver_len;
+    uint16_t content_len;
+
+    memset(msg, 0, sizeof(*msg));
+    if (get_bytes(pos, end, &id, sizeof(id)) != 0
+            || get_bytes(pos, end, &time_sent, sizeof(time_sent)) != 0
+            || get_bytes(pos, end, &delivered, sizeof(delivered)) != 0
+            || get_bytes(pos, end, &sender_len, sizeof(sender_len)) != 0
+            || sender_len >= sizeof(msg->sender)
+            || get_bytes(pos, end, msg->sender, sender_len) != 0
+            || get_bytes(pos, end, &receiver_len, sizeof(receiver_len)) != 0
+            || receiver_len >= sizeof(msg->receiver)
+            || get_bytes(pos, end, msg->receiver, receiver_len) != 0
+            || get_bytes(pos, end, &content_len, sizeof(content_len)) != 0
+            || content_len >= sizeof(msg->content)
+            || get_bytes(pos, end, msg->content, content_len) != 0) {
+        return -1;
+    }
+    msg->identifier = id;
+    msg->time_sent = (time_t)time_sent;
+    msg->delivered = delivered;
+    return 0;
+}
+
+/**
+ * Decodes a hit status, followed by the message when there is one.
+ *
+ * @param pos Read position, advanced past the status.
+ * @param end End of the readable bytes.
+ * @param status Pointer to the status to fill in.
+ * @return 0 on success, -1 on malformed input.
+ */
+int proto_get_status(const unsigned char **pos, const unsigned char *end, t_message_status *status) {
+    uint8_t hit_status;
+    memset(status, 0, sizeof(*status));
+    if (proto_get_u8(pos, end, &hit_status) != 0) return -1;
+    status->hit_status = hit_status;
+    if (hit_status == 3) {
+        return 0; // not found, no message follows
+    }
+    return proto_get_message(pos, end, &status->message);
+}
+
+/**
+ * Tells whether a whole frame is waiting at the read position of a buffer.
+ *
+ * @param buf Pointer to the buffer.
+ * @param frame_length Set to the length of the frame (after its length field).
+ * @return 1 if a frame is complete, 0 if more bytes are needed, -1 if the frame is malformed.
+ */
+int proto_frame_ready(const t_proto_buffer *buf, uint32_t *frame_length) {
+    size_t available = buf->len - buf->pos;
+    if (available < sizeof(uint32_t)) return 0;
+    memcpy(frame_length, buf->data + buf->pos, sizeof(uint32_t));
+    if (*frame_length < PROTO_HEADER_SIZE - sizeof(uint32_t) || *frame_length > PROTO_MAX_FRAME) {
+        return -1;
+    }
+    return available >= sizeof(uint32_t) + *frame_length;
+}
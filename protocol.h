@@ -0,0 +1,60 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include "message.h"
+#include "cache.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Wire format of the cache daemon. Every frame is a 9 byte header followed by
+ * a payload; integers are in host byte order, since both ends share the host.
+ *
+ *   request:  u32 length | u32 request_id | u8 opcode | payload
+ *   response: u32 length | u32 request_id | u8 status | payload
+ *
+ * length counts the bytes after itself. Responses come back in request order,
+ * so clients may pipeline any number of requests before reading.
+ */
+
+#define PROTO_HEADER_SIZE 9
+#define PROTO_MAX_FRAME (1024 * 1024)
+#define PROTO_MAX_MGET 4096
+
+#define OP_GET 1 // payload: i32 id; response: u8 hit_status [message]
+#define OP_PUT 2 // payload: message; response: empty
+#define OP_MGET 3 // payload: u32 count, i32 ids[count]; response: u32 count, count x (u8 hit_status [message])
+
+#define STATUS_OK 0
+#define STATUS_BAD_REQUEST 1
+#define STATUS_ERROR 2
+
+/**
+ * @brief growable byte buffer used to build and parse frames
+ */
+typedef struct t_proto_buffer {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+    size_t pos; // read position
+} t_proto_buffer;
+
+void proto_buffer_init(t_proto_buffer *buf);
+void proto_buffer_free(t_proto_buffer *buf);
+int proto_buffer_reserve(t_proto_buffer *buf, size_t extra);
+void proto_buffer_consume(t_proto_buffer *buf, size_t count);
+
+int proto_put_u8(t_proto_buffer *buf, uint8_t value);
+int proto_put_u32(t_proto_buffer *buf, uint32_t value);
+int proto_put_message(t_proto_buffer *buf, const t_message *msg);
+int proto_begin_frame(t_proto_buffer *buf, uint32_t request_id, uint8_t code, size_t *frame_start);
+void proto_end_frame(t_proto_buffer *buf, size_t frame_start);
+
+int proto_get_u8(const unsigned char **pos, const unsigned char *end, uint8_t *value);
+int proto_get_u32(const unsigned char **pos, const unsigned char *end, uint32_t *value);
+int proto_get_message(const unsigned char **pos, const unsigned char *end, t_message *msg);
+int proto_get_status(const unsigned char **pos, const unsigned char *end, t_message_status *status);
+int proto_frame_ready(const t_proto_buffer *buf, uint32_t *frame_length);
+
+#endif // PROTOCOL_H
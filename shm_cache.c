@@ -0,0 +1,478 @@
+#include "shm_cache.h"
+#include "store.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_OPEN_WAIT_US 1000
+#define SHM_OPEN_ATTEMPTS 1000 // how long to wait for another process to finish creating the segment
+
+
+static size_t segment_size(int capacity) {
+    return sizeof(t_shm_header) + (size_t)capacity * sizeof(int32_t) + (size_t)capacity * sizeof(t_shm_slot);
+}
+
+static void map_layout(t_shm_cache *cache, void *base, size_t size) {
+    cache->header = (t_shm_header *)base;
+    cache->buckets = (int32_t *)(cache->header + 1);
+    cache->slots = (t_shm_slot *)(cache->buckets + cache->header->capacity);
+    cache->size = size;
+}
+
+static int32_t bucket_of(const t_shm_header *header, int identifier) {
+    return (int32_t)((uint32_t)identifier % (uint32_t)header->bucket_count);
+}
+
+static void set_state(t_shm_slot *slot, int32_t state) {
+    // Kept in program order with the copy, so a crash never leaves a torn message marked valid
+    __atomic_store_n(&slot->state, state, __ATOMIC_RELEASE);
+}
+
+/**
+ * Marks a slot as changed, before its message is touched, so copies taken
+ * from it (see near_cache.c) stop matching.
+ */
+static void bump_version(t_shm_slot *slot) {
+    __atomic_store_n(&slot->version, slot->version + 1, __ATOMIC_RELEASE);
+}
+
+static void lru_unlink_locked(t_shm_cache *cache, int32_t index) {
+    t_shm_header *header = cache->header;
+    t_shm_slot *slot = &cache->slots[index];
+    if (slot->lru_prev != SHM_NIL) cache->slots[slot->lru_prev].lru_next = slot->lru_next;
+    else header->lru_head = slot->lru_next;
+    if (slot->lru_next != SHM_NIL) cache->slots[slot->lru_next].lru_prev = slot->lru_prev;
+    else header->lru_tail = slot->lru_prev;
+    slot->lru_prev = slot->lru_next = SHM_NIL;
+}
+
+static void lru_push_head_locked(t_shm_cache *cache, int32_t index) {
+    t_shm_header *header = cache->header;
+    t_shm_slot *slot = &cache->slots[index];
+    slot->lru_prev = SHM_NIL;
+    slot->lru_next = header->lru_head;
+    if (header->lru_head != SHM_NIL) cache->slots[header->lru_head].lru_prev = index;
+    header->lru_head = index;
+    if (header->lru_tail == SHM_NIL) header->lru_tail = index;
+}
+
+static void bucket_unlink_locked(t_shm_cache *cache, int32_t index) {
+    int32_t *link = &cache->buckets[bucket_of(cache->header, cache->slots[index].message.identifier)];
+    while (*link != SHM_NIL && *link != index) {
+        link = &cache->slots[*link].hash_next;
+    }
+    if (*link == index) *link = cache->slots[index].hash_next;
+}
+
+static int32_t find_locked(t_shm_cache *cache, int identifier) {
+    int32_t index = cache->buckets[bucket_of(cache->header, identifier)];
+    while (index != SHM_NIL && cache->slots[index].message.identifier != identifier) {
+        index = cache->slots[index].hash_next;
+    }
+    return index;
+}
+
+/**
+ * Returns a slot to the free list.
+ */
+static void release_locked(t_shm_cache *cache, int32_t index) {
+    t_shm_header *header = cache->header;
+    bucket_unlink_locked(cache, index);
+    lru_unlink_locked(cache, index);
+    bump_version(&cache->slots[index]);
+    set_state(&cache->slots[index], SHM_SLOT_FREE);
+    cache->slots[index].hash_next = header->free_head;
+    header->free_head = index;
+    header->count--;
+}
+
+typedef struct t_slot_use {
+    uint64_t last_used;
+    int32_t index;
+} t_slot_use;
+
+static int compare_last_used(const void *a, const void *b) {
+    uint64_t ua = ((const t_slot_use *)a)->last_used;
+    uint64_t ub = ((const t_slot_use *)b)->last_used;
+    return (ua > ub) - (ua < ub);
+}
+
+/**
+ * Rebuilds the buckets, the LRU list and the free list from the slot states
+ * after a process died holding the lock. Slots caught mid-copy are dropped;
+ * the recency order of the others is restored from their access ticks.
+ */
+static void repair_locked(t_shm_cache *cache) {
+    t_shm_header *header = cache->header;
+    t_slot_use *valid = (t_slot_use *)malloc(sizeof(t_slot_use) * header->capacity);
+    int count = 0;
+
+    for (int32_t b = 0; b < header->bucket_count; b++) {
+        cache->buckets[b] = SHM_NIL;
+    }
+    header->lru_head = header->lru_tail = header->free_head = SHM_NIL;
+    for (int32_t i = header->capacity - 1; i >= 0; i--) {
+        t_shm_slot *slot = &cache->slots[i];
+        slot->lru_prev = slot->lru_next = SHM_NIL;
+        if (slot->state == SHM_SLOT_VALID && valid && find_locked(cache, slot->message.identifier) == SHM_NIL) {
+            slot->hash_next = cache->buckets[bucket_of(header, slot->message.identifier)];
+            cache->buckets[bucket_of(header, slot->message.identifier)] = i;
+            valid[count++] = (t_slot_use){ slot->last_used, i };
+        } else {
+            set_state(slot, SHM_SLOT_FREE);
+            slot->hash_next = header->free_head;
+            header->free_head = i;
+        }
+    }
+
+    // Oldest first, so the most recently used ends up at the head
+    qsort(valid, count, sizeof(t_slot_use), compare_last_used);
+    for (int i = 0; i < count; i++) {
+        lru_push_head_locked(cache, valid[i].index);
+    }
+    header->count = count;
+    header->recoveries++;
+    __atomic_store_n(&header->epoch, header->epoch + 1, __ATOMIC_RELEASE);
+    free(valid);
+}
+
+/**
+ * Takes the segment lock, repairing the segment first if its previous owner
+ * died in the middle of an update.
+ *
+ * @return 0 once the lock is held, -1 if the segment is unusable.
+ */
+static int lock_segment(t_shm_cache *cache) {
+    int rc = pthread_mutex_lock(&cache->header->lock);
+    if (rc == EOWNERDEAD) {
+        fprintf(stderr, "Warning: A process died while updating the shared cache, repairing it.\n");
+        repair_locked(cache);
+        pthread_mutex_consistent(&cache->header->lock);
+        return 0;
+    }
+    if (rc != 0) {
+        fprintf(stderr, "Error: Unable to lock the shared cache: %s\n", strerror(rc));
+        return -1;
+    }
+    return 0;
+}
+
+static int init_segment(t_shm_cache *cache, int capacity) {
+    t_shm_header *header = cache->header;
+    header->version = SHM_CACHE_VERSION;
+    header->capacity = capacity;
+    header->bucket_count = capacity;
+    header->lru_head = header->lru_tail = SHM_NIL;
+    header->count = 0;
+    header->tick = header->hits = header->misses = header->recoveries = header->epoch = 0;
+    map_layout(cache, header, cache->size);
+
+    for (int32_t i = 0; i < capacity; i++) {
+        cache->buckets[i] = SHM_NIL;
+        cache->slots[i].state = SHM_SLOT_FREE;
+        cache->slots[i].version = 0;
+        cache->slots[i].hash_next = i + 1 < capacity ? i + 1 : SHM_NIL;
+        cache->slots[i].lru_prev = cache->slots[i].lru_next = SHM_NIL;
+    }
+    header->free_head = 0;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    int rc = pthread_mutex_init(&header->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    if (rc != 0) return -1;
+
+    // Published last: processes attaching meanwhile wait for it
+    __atomic_store_n(&header->magic, SHM_CACHE_MAGIC, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Attaches to a named shared cache segment, creating it if no process has yet.
+ *
+ * @param name POSIX shared memory name, e.g. SHM_CACHE_NAME.
+ * @param capacity Number of message slots, used only when creating the segment.
+ * @return Pointer to the mapping, or NULL on failure. Release it with shm_cache_close.
+ */
+t_shm_cache* shm_cache_open(const char *name, int capacity) {
+    if (capacity <= 0) return NULL;
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool creator = fd >= 0;
+    if (!creator && errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        perror("Error opening shared cache");
+        return NULL;
+    }
+
+    size_t size = segment_size(capacity);
+    if (creator) {
+        if (ftruncate(fd, size) != 0) {
+            perror("Error sizing shared cache");
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+    } else {
+        // The creator may not have sized the segment yet
+        struct stat st;
+        int attempt = 0;
+        int rc;
+        while ((rc = fstat(fd, &st)) == 0 && st.st_size == 0 && ++attempt < SHM_OPEN_ATTEMPTS) {
+            usleep(SHM_OPEN_WAIT_US);
+        }
+        if (rc != 0) {
+            perror("Error reading shared cache size");
+            close(fd);
+            return NULL;
+        }
+        size = st.st_size;
+        if (size < sizeof(t_shm_header)) {
+            fprintf(stderr, "Error: Shared cache %s is not initialised.\n", name);
+            close(fd);
+            return NULL;
+        }
+    }
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("Error mapping shared cache");
+        if (creator) shm_unlink(name);
+        return NULL;
+    }
+
+    t_shm_cache *cache = (t_shm_cache *)malloc(sizeof(t_shm_cache));
+    if (!cache) {
+        fprintf(stderr, "Error: Memory allocation failed for t_shm_cache.\n");
+        munmap(base, size);
+        return NULL;
+    }
+    cache->header = (t_shm_header *)base;
+    cache->size = size;
+
+    if (creator) {
+        if (init_segment(cache, capacity) != 0) {
+            fprintf(stderr, "Error: Unable to initialise shared cache lock.\n");
+            shm_cache_close(cache);
+            shm_unlink(name);
+            return NULL;
+        }
+        return cache;
+    }
+
+    int attempt = 0;
+    while (__atomic_load_n(&cache->header->magic, __ATOMIC_ACQUIRE) != SHM_CACHE_MAGIC && ++attempt < SHM_OPEN_ATTEMPTS) {
+        usleep(SHM_OPEN_WAIT_US);
+    }
+    if (cache->header->magic != SHM_CACHE_MAGIC || cache->header->version != SHM_CACHE_VERSION || segment_size(cache->header->capacity) != size) {
+        fprintf(stderr, "Error: Shared cache %s has an unexpected layout.\n", name);
+        munmap(base, size);
+        free(cache);
+        return NULL;
+    }
+    map_layout(cache, base, size);
+    return cache;
+}
+
+/**
+ * Detaches from a shared cache segment. The segment itself stays around for
+ * the other processes; see shm_cache_unlink.
+ *
+ * @param cache Pointer to the mapping.
+ */
+void shm_cache_close(t_shm_cache *cache) {
+    if (!cache) return;
+    munmap(cache->header, cache->size);
+    free(cache);
+}
+
+/**
+ * Removes a shared cache segment's name. Processes still attached keep their mapping.
+ *
+ * @param name POSIX shared memory name.
+ * @return 0 on success, -1 on failure.
+ */
+int shm_cache_unlink(const char *name) {
+    return shm_unlink(name) == 0 ? 0 : -1;
+}
+
+/**
+ * Looks a message up in the shared cache, making it the most recently used.
+ *
+ * @param cache Pointer to the mapping.
+ * @param identifier The unique identifier of the message.
+ * @param msg Filled in with a copy of the cached message on a hit.
+ * @return 1 on a hit, 0 on a miss, -1 on failure.
+ */
+int shm_cache_get(t_shm_cache *cache, int identifier, t_message *msg) {
+    int32_t slot;
+    uint64_t version, epoch;
+    return shm_cache_get_versioned(cache, identifier, msg, &slot, &version, &epoch);
+}
+
+/**
+ * Looks a message up like shm_cache_get, and also reports which slot holds it
+ * and that slot's version, so the copy can be revalidated later without the lock.
+ *
+ * @param cache Pointer to the mapping.
+ * @param identifier The unique identifier of the message.
+ * @param msg Filled in with a copy of the cached message on a hit.
+ * @param slot_index Set to the slot holding the message on a hit.
+ * @param version Set to the slot's version on a hit.
+ * @param epoch Set to the segment's epoch on a hit.
+ * @return 1 on a hit, 0 on a miss, -1 on failure.
+ */
+int shm_cache_get_versioned(t_shm_cache *cache, int identifier, t_message *msg, int32_t *slot_index, uint64_t *version, uint64_t *epoch) {
+    if (lock_segment(cache) != 0) return -1;
+    t_shm_header *header = cache->header;
+    int32_t index = find_locked(cache, identifier);
+    if (index != SHM_NIL) {
+        t_shm_slot *slot = &cache->slots[index];
+        *msg = slot->message;
+        *slot_index = index;
+        *version = slot->version;
+        *epoch = header->epoch;
+        slot->last_used = ++header->tick;
+        lru_unlink_locked(cache, index);
+        lru_push_head_locked(cache, index);
+        header->hits++;
+    } else {
+        header->misses++;
+    }
+    pthread_mutex_unlock(&header->lock);
+    return index != SHM_NIL;
+}
+
+/**
+ * Adds a message to the shared cache, or refreshes the cached copy, evicting
+ * the least recently used message when every slot is taken.
+ *
+ * @param cache Pointer to the mapping.
+ * @param msg Pointer to the message.
+ * @return 0 on success, -1 on failure.
+ */
+int shm_cache_put(t_shm_cache *cache, const t_message *msg) {
+    if (lock_segment(cache) != 0) return -1;
+    t_shm_header *header = cache->header;
+
+    int32_t index = find_locked(cache, msg->identifier);
+    if (index != SHM_NIL) {
+        lru_unlink_locked(cache, index);
+    } else {
+        if (header->free_head == SHM_NIL) {
+            release_locked(cache, header->lru_tail);
+        }
+        index = header->free_head;
+        header->free_head = cache->slots[index].hash_next;
+        cache->slots[index].hash_next = SHM_NIL;
+    }
+
+    t_shm_slot *slot = &cache->slots[index];
+    bool linked = slot->state == SHM_SLOT_VALID;
+    bump_version(slot);
+    set_state(slot, SHM_SLOT_WRITING);
+    slot->message = *msg;
+    slot->last_used = ++header->tick;
+    set_state(slot, SHM_SLOT_VALID);
+
+    if (!linked) {
+        int32_t bucket = bucket_of(header, msg->identifier);
+        slot->hash_next = cache->buckets[bucket];
+        cache->buckets[bucket] = index;
+        header->count++;
+    }
+    lru_push_head_locked(cache, index);
+    pthread_mutex_unlock(&header->lock);
+    return 0;
+}
+
+/**
+ * Drops a message from the shared cache.
+ *
+ * @param cache Pointer to the mapping.
+ * @param identifier The unique identifier of the message.
+ * @return 1 if it was cached, 0 if not, -1 on failure.
+ */
+int shm_cache_remove(t_shm_cache *cache, int identifier) {
+    if (lock_segment(cache) != 0) return -1;
+    int32_t index = find_locked(cache, identifier);
+    if (index != SHM_NIL) {
+        release_locked(cache, index);
+    }
+    pthread_mutex_unlock(&cache->header->lock);
+    return index != SHM_NIL;
+}
+
+/**
+ * Reads the shared cache's counters, which cover every attached process.
+ *
+ * @param cache Pointer to the mapping.
+ * @param stats Filled in with the counters.
+ */
+void shm_cache_get_stats(t_shm_cache *cache, t_shm_cache_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (lock_segment(cache) != 0) return;
+    t_shm_header *header = cache->header;
+    stats->capacity = header->capacity;
+    stats->count = header->count;
+    stats->hits = header->hits;
+    stats->misses = header->misses;
+    stats->recoveries = header->recoveries;
+    pthread_mutex_unlock(&header->lock);
+}
+
+/**
+ * Retrieve a message through the shared cache, like retrieve_msg. Cached
+ * messages are returned as copies, since another process may replace the slot.
+ *
+ * @param cache Pointer to the mapping.
+ * @param identifier The unique identifier of the message to retrieve.
+ * @return Pointer to the message status (1: in cache, 2: on disk, 3: not found), or NULL on failure. The caller is responsible for freeing it.
+ */
+t_message_status* shm_retrieve_msg(t_shm_cache *cache, int identifier) {
+    t_message_status* msg_status = (t_message_status*)calloc(1, sizeof(t_message_status));
+    if (!msg_status) {
+        fprintf(stderr, "Memory allocation failed.\n");
+        return NULL;
+    }
+
+    int hit = shm_cache_get(cache, identifier, &msg_status->message);
+    if (hit == 1) {
+        msg_status->hit_status = 1;
+    } else if (hit == 0 && store_get(identifier, &msg_status->message) == 1) {
+        shm_cache_put(cache, &msg_status->message);
+        msg_status->hit_status = 2;
+    } else if (hit == 0) {
+        msg_status->hit_status = 3;
+    } else {
+        free(msg_status);
+        return NULL;
+    }
+    return msg_status;
+}
+
+/**
+ * Store a message in the shared cache and on disk, like store_msg.
+ *
+ * @param cache Pointer to the mapping.
+ * @param msg Pointer to the message to be stored.
+ */
+void shm_store_msg(t_shm_cache *cache, const t_message *msg) {
+    if (!msg) return;
+    shm_cache_put(cache, msg);
+
+    int stored = store_insert(msg);
+    if (stored < 0) {
+        fprintf(stderr, "Error: Unable to store message %d on disk.\n", msg->identifier);
+    }
+}
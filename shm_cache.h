@@ -0,0 +1,84 @@
+#ifndef SHM_CACHE_H
+#define SHM_CACHE_H
+
+#include "message.h"
+#include "cache.h"
+
+#include <stdint.h>
+#include <pthread.h>
+
+#define SHM_CACHE_NAME "/p1_message_cache"
+#define SHM_CACHE_MAGIC 0x53484d43u // "SHMC"
+#define SHM_CACHE_VERSION 2
+#define SHM_NIL (-1) // null link
+
+#define SHM_SLOT_FREE 0
+#define SHM_SLOT_WRITING 1 // a copy into the slot is in progress
+#define SHM_SLOT_VALID 2
+
+/**
+ * @brief one message slot in the segment. Links are slot numbers, never
+ * pointers, because every process maps the segment at a different address.
+ */
+typedef struct t_shm_slot {
+    int32_t state; // SHM_SLOT_FREE, SHM_SLOT_WRITING or SHM_SLOT_VALID
+    int32_t hash_next; // next slot in the same bucket
+    int32_t lru_prev;
+    int32_t lru_next;
+    uint64_t last_used; // access tick, used to rebuild the LRU order after a crash
+    uint64_t version; // bumped whenever the slot's message changes or leaves, read without the lock
+    t_message message;
+} t_shm_slot;
+
+/**
+ * @brief the segment header, followed by the buckets and then the slots
+ */
+typedef struct t_shm_header {
+    uint32_t magic; // written last, once the segment is initialised
+    uint32_t version;
+    int32_t capacity;
+    int32_t bucket_count;
+    pthread_mutex_t lock; // process-shared and robust
+    int32_t lru_head;
+    int32_t lru_tail;
+    int32_t free_head; // free slots, chained through hash_next
+    int32_t count;
+    uint64_t tick;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t recoveries; // times a dead owner's half-done update was repaired
+    uint64_t epoch; // bumped when the whole segment is rebuilt, read without the lock
+} t_shm_header;
+
+/**
+ * @brief one process's mapping of a shared cache segment
+ */
+typedef struct t_shm_cache {
+    t_shm_header *header;
+    int32_t *buckets;
+    t_shm_slot *slots;
+    size_t size;
+} t_shm_cache;
+
+typedef struct t_shm_cache_stats {
+    int capacity;
+    int count;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long recoveries;
+} t_shm_cache_stats;
+
+t_shm_cache* shm_cache_open(const char *name, int capacity);
+void shm_cache_close(t_shm_cache *cache);
+int shm_cache_unlink(const char *name);
+
+int shm_cache_get(t_shm_cache *cache, int identifier, t_message *msg);
+int shm_cache_get_versioned(t_shm_cache *cache, int identifier, t_message *msg, int32_t *slot_index, uint64_t *version, uint64_t *epoch);
+int shm_cache_put(t_shm_cache *cache, const t_message *msg);
+int shm_cache_remove(t_shm_cache *cache, int identifier);
+void shm_cache_get_stats(t_shm_cache *cache, t_shm_cache_stats *stats);
+
+t_message_status* shm_retrieve_msg(t_shm_cache *cache, int identifier);
+void shm_store_msg(t_shm_cache *cache, const t_message *msg);
+
+#endif // SHM_CACHE_H
@@ -0,0 +1,285 @@
+#include "sizer.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define SIZER_FLAT_EPSILON 0.01 // hit ratio not worth the memory once the curve is this flat
+
+/**
+ * @brief one sampled id in the recency stack. Ids past the cache's capacity
+ * are ghosts: evicted from the cache, remembered here by id only.
+ */
+typedef struct t_stack_node {
+    int id;
+    int time; // logical time of its last access, its mark in the Fenwick tree
+    struct t_stack_node *prev;
+    struct t_stack_node *next;
+    struct t_stack_node *hash_next;
+} t_stack_node;
+
+static t_sizer_config config;
+static bool enabled = false;
+static int max_capacity = 0; // largest capacity the memory ceiling allows
+static int histogram_size = 0; // largest stack distance measured
+static double *histogram = NULL; // weighted accesses per stack distance
+static double sampled_accesses = 0;
+static unsigned int sample_threshold = SIZER_SAMPLE_SPACE;
+static int since_decision = 0;
+
+static t_stack_node *stack_head = NULL;
+static t_stack_node *stack_tail = NULL;
+static int stack_size = 0;
+static int stack_limit = 0;
+static t_stack_node **buckets = NULL;
+static int bucket_count = 0;
+
+// Fenwick tree over logical access times, with a 1 at each tracked id's last
+// access: the ids above an id in the stack are the marks after its time
+static int *fenwick = NULL;
+static int window = 0; // logical times before they are renumbered
+static int clock_now = 0; // next logical time
+
+
+static unsigned int sample_hash(int id) {
+    return ((unsigned int)id * 2654435761u) >> 7;
+}
+
+static t_stack_node **bucket_of(int id) {
+    return &buckets[(unsigned int)id % bucket_count];
+}
+
+static void stack_unlink(t_stack_node *node) {
+    if (node->prev) node->prev->next = node->next;
+    else stack_head = node->next;
+    if (node->next) node->next->prev = node->prev;
+    else stack_tail = node->prev;
+}
+
+static void stack_push(t_stack_node *node) {
+    node->prev = NULL;
+    node->next = stack_head;
+    if (stack_head) stack_head->prev = node;
+    stack_head = node;
+    if (!stack_tail) stack_tail = node;
+}
+
+static void fenwick_add(int time, int delta) {
+    for (int i = time + 1; i <= window; i += i & -i) fenwick[i] += delta;
+}
+
+/**
+ * Counts the marks at logical times before the given one.
+ */
+static int fenwick_prefix(int time) {
+    int sum = 0;
+    for (int i = time; i > 0; i -= i & -i) sum += fenwick[i];
+    return sum;
+}
+
+/**
+ * Renumbers the tracked ids 0, 1, ... from the bottom of the stack up, once
+ * the window of logical times is used up. The stack is at most half the
+ * window, so this happens at most once per stack_limit accesses.
+ */
+static void renumber(void) {
+    memset(fenwick, 0, (window + 1) * sizeof(int));
+    clock_now = 0;
+    for (t_stack_node *node = stack_tail; node; node = node->prev) {
+        node->time = clock_now++;
+        fenwick_add(node->time, 1);
+    }
+}
+
+static void forget(t_stack_node *node) {
+    fenwick_add(node->time, -1);
+    t_stack_node **link = bucket_of(node->id);
+    while (*link != node) link = &(*link)->hash_next;
+    *link = node->hash_next;
+    stack_unlink(node);
+    free(node);
+    stack_size--;
+}
+
+/**
+ * Starts estimating the hit ratio curve, replacing any earlier estimate.
+ *
+ * @param sizer_config How the cache may be resized.
+ * @param entry_bytes Memory one cached message takes, to turn the ceiling into a capacity.
+ * @return 0 on success, -1 on failure.
+ */
+int sizer_init(const t_sizer_config *sizer_config, int entry_bytes) {
+    sizer_free();
+    if (entry_bytes <= 0 || sizer_config->memory_ceiling < entry_bytes || sizer_config->sample_rate <= 0 || sizer_config->sample_rate > 1) {
+        fprintf(stderr, "Error: Invalid cache sizing configuration.\n");
+        return -1;
+    }
+    config = *sizer_config;
+    if (config.interval <= 0) config.interval = SIZER_DEFAULT_INTERVAL;
+    if (config.min_capacity < 1) config.min_capacity = 1;
+    max_capacity = (int)(config.memory_ceiling / entry_bytes);
+    if (config.min_capacity > max_capacity) config.min_capacity = max_capacity;
+
+    histogram_size = max_capacity * SIZER_GHOST_FACTOR;
+    sample_threshold = (unsigned int)(config.sample_rate * SIZER_SAMPLE_SPACE);
+    if (sample_threshold == 0) sample_threshold = 1;
+    stack_limit = (int)(histogram_size * config.sample_rate) + 1;
+    bucket_count = stack_limit;
+    window = 2 * stack_limit + 1;
+    clock_now = 0;
+
+    histogram = (double *)calloc(histogram_size, sizeof(double));
+    buckets = (t_stack_node **)calloc(bucket_count, sizeof(t_stack_node *));
+    fenwick = (int *)calloc(window + 1, sizeof(int));
+    if (!histogram || !buckets || !fenwick) {
+        fprintf(stderr, "Error: Memory allocation failed for cache sizer.\n");
+        sizer_free();
+        return -1;
+    }
+    enabled = true;
+    return 0;
+}
+
+/**
+ * Stops estimating and frees the recency stack.
+ */
+void sizer_free(void) {
+    while (stack_head) {
+        t_stack_node *next = stack_head->next;
+        free(stack_head);
+        stack_head = next;
+    }
+    stack_tail = NULL;
+    stack_size = 0;
+    free(histogram);
+    free(buckets);
+    free(fenwick);
+    histogram = NULL;
+    buckets = NULL;
+    fenwick = NULL;
+    sampled_accesses = 0;
+    since_decision = 0;
+    enabled = false;
+}
+
+bool sizer_enabled(void) {
+    return enabled;
+}
+
+/**
+ * Records one cache access. For a sampled id, its depth in the recency stack
+ * (scaled up by the sampling rate) is the smallest LRU capacity that would
+ * have made this access a hit. The depth is counted in O(log stack) with the
+ * Fenwick tree, as the number of tracked ids accessed since this one.
+ *
+ * @param identifier The id that was accessed, hit or miss.
+ * @return true when a resize decision is due.
+ */
+bool sizer_record(int identifier) {
+    if (!enabled) return false;
+
+    if (sample_hash(identifier) % SIZER_SAMPLE_SPACE < sample_threshold) {
+        sampled_accesses++;
+        if (clock_now == window) renumber();
+        t_stack_node *node = *bucket_of(identifier);
+        while (node && node->id != identifier) node = node->hash_next;
+
+        if (node) {
+            int depth = stack_size - fenwick_prefix(node->time + 1);
+            int distance = (int)(depth / config.sample_rate);
+            if (distance < histogram_size) histogram[distance]++;
+            fenwick_add(node->time, -1);
+            stack_unlink(node);
+        } else {
+            node = (t_stack_node *)malloc(sizeof(t_stack_node));
+            if (!node) return false;
+            node->id = identifier;
+            node->hash_next = *bucket_of(identifier);
+            *bucket_of(identifier) = node;
+            stack_size++;
+            if (stack_size > stack_limit) forget(stack_tail);
+        }
+        node->time = clock_now++;
+        fenwick_add(node->time, 1);
+        stack_push(node);
+    }
+
+    if (++since_decision < config.interval) return false;
+    since_decision = 0;
+    return true;
+}
+
+/**
+ * Estimated hit ratio of an LRU cache of the given capacity, over recent accesses.
+ *
+ * @param capacity Number of cached messages.
+ * @return Estimated hit ratio, between 0 and 1.
+ */
+double sizer_hit_ratio(int capacity) {
+    if (!enabled || sampled_accesses == 0) return 0;
+    if (capacity > histogram_size) capacity = histogram_size;
+    double hits = 0;
+    for (int d = 0; d < capacity; d++) hits += histogram[d];
+    return hits / sampled_accesses;
+}
+
+/**
+ * Chooses a capacity: the smallest that reaches the target hit ratio within
+ * the memory ceiling, or, if none does, the smallest past which the curve
+ * is flat. Older accesses then lose weight, so the curve follows the workload.
+ *
+ * @param current_capacity The cache's capacity now.
+ * @return The capacity to use.
+ */
+int sizer_recommend(int current_capacity) {
+    if (!enabled || sampled_accesses == 0) return current_capacity;
+
+    int choice = -1;
+    double best = sizer_hit_ratio(max_capacity);
+    double hits = 0;
+    for (int c = 1; c <= max_capacity; c++) {
+        hits += histogram[c - 1];
+        double ratio = hits / sampled_accesses;
+        if (c >= config.min_capacity && (ratio >= config.target_hit_ratio || ratio >= best - SIZER_FLAT_EPSILON)) {
+            choice = c;
+            break;
+        }
+    }
+    if (choice < 0) choice = max_capacity;
+
+    for (int d = 0; d < histogram_size; d++) histogram[d] *= SIZER_DECAY;
+    sampled_accesses *= SIZER_DECAY;
+    return config.adjust ? choice : current_capacity;
+}
+
+/**
+ * Samples the estimated hit ratio curve at evenly spaced capacities, up to
+ * SIZER_GHOST_FACTOR times the memory ceiling, so the value of more memory
+ * shows even past what the ceiling allows.
+ *
+ * @param points Array of count points to fill in.
+ * @param count Number of points wanted.
+ * @return Number of points filled in.
+ */
+int sizer_get_curve(t_sizer_point *points, int count) {
+    if (!enabled || count <= 0) return 0;
+    if (count > histogram_size) count = histogram_size;
+    int previous_capacity = 0;
+    double previous_ratio = 0;
+    for (int i = 0; i < count; i++) {
+        int capacity = (int)((long)(i + 1) * histogram_size / count);
+        double ratio = sizer_hit_ratio(capacity);
+        points[i] = (t_sizer_point){ capacity, ratio, (ratio - previous_ratio) / (capacity - previous_capacity) };
+        previous_capacity = capacity;
+        previous_ratio = ratio;
+    }
+    return count;
+}
+
+/**
+ * Largest capacity the memory ceiling allows.
+ */
+int sizer_max_capacity(void) {
+    return enabled ? max_capacity : 0;
+}
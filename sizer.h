@@ -0,0 +1,41 @@
+#ifndef SIZER_H
+#define SIZER_H
+
+#include <stdbool.h>
+
+#define SIZER_SAMPLE_SPACE 1024 // ids are sampled by hash, rate = tracked / SIZER_SAMPLE_SPACE
+#define SIZER_GHOST_FACTOR 2 // the stack tracks ids up to this many times the largest capacity
+#define SIZER_DEFAULT_INTERVAL 256
+#define SIZER_DECAY 0.5 // weight kept by old accesses at each decision
+
+/**
+ * @brief how the cache may be resized
+ */
+typedef struct t_sizer_config {
+    long memory_ceiling; // bytes the cache may use at most
+    int min_capacity;
+    double target_hit_ratio; // smallest capacity reaching it is chosen
+    double sample_rate; // fraction of ids tracked, (0, 1]
+    int interval; // accesses between two resize decisions
+    bool adjust; // false: only estimate the curve, never resize
+} t_sizer_config;
+
+/**
+ * @brief one point of the estimated hit ratio curve
+ */
+typedef struct t_sizer_point {
+    int capacity;
+    double hit_ratio;
+    double marginal; // hit ratio gained per extra message of capacity, from the previous point
+} t_sizer_point;
+
+int sizer_init(const t_sizer_config *config, int entry_bytes);
+void sizer_free(void);
+bool sizer_enabled(void);
+bool sizer_record(int identifier);
+int sizer_recommend(int current_capacity);
+double sizer_hit_ratio(int capacity);
+int sizer_get_curve(t_sizer_point *points, int count);
+int sizer_max_capacity(void);
+
+#endif // SIZER_H
@@ -0,0 +1,1664 @@
+#include "store.h"
+#include "message.h"
+#include "index.h"
+#include "time_index.h"
+#include "delivery.h"
+#include "utility.h"
+#include "msg_scan.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#define KEYDIR_INITIAL_SIZE 1024
+#define SCAN_CHUNK_SIZE (64 * 1024)
+#define RECOVERY_MIN_CHUNK (1024 * 1024)
+#define RECOVERY_MAX_THREADS 64
+#define TOMBSTONE_OFFSET -1
+#define HINT_MAGIC "KDIR"
+#define HINT_VERSION 1
+#define HINT_TAIL_BYTES 64
+#define BATCH_MAX_SPAN (256 * 1024) // widest run of the file read with one pread
+
+enum { SLOT_EMPTY = 0, SLOT_USED, SLOT_DELETED };
+
+/**
+ * @brief location of the live record of one message in the message file
+ */
+typedef struct t_keydir_entry {
+    int id;
+    int state;
+    long offset;
+    int length;
+    long long time_sent;
+} t_keydir_entry;
+
+/**
+ * @brief open addressing hash table from message id to its live record
+ */
+typedef struct t_keydir {
+    t_keydir_entry *slots;
+    int size; // power of two
+    int used; // live entries
+    int filled; // live and deleted slots
+    long live_bytes;
+    long garbage_bytes;
+} t_keydir;
+
+/**
+ * @brief header of the keydir hint file, followed by count t_hint_entry records
+ */
+typedef struct t_hint_header {
+    char magic[4];
+    int version;
+    long covered_size; // bytes of the message file described by the hint
+    unsigned int tail_crc; // checksum of the last bytes it covers, to notice a replaced file
+    int count;
+} t_hint_header;
+
+typedef struct t_hint_entry {
+    int id;
+    int length;
+    long offset;
+    long long time_sent;
+} t_hint_entry;
+
+/**
+ * @brief one slice of the message file, indexed by its own thread during recovery
+ */
+typedef struct t_recovery_chunk {
+    int fd;
+    long start;
+    long end;
+    long scanned_end; // offset just past the last complete line
+    long intact_end; // offset just past the last record that is not torn
+    t_keydir partial; // last event per id in this chunk, tombstones have offset TOMBSTONE_OFFSET
+    pthread_t thread;
+} t_recovery_chunk;
+
+typedef void (*t_line_handler)(const char *line, long offset, int length, void *arg);
+
+/**
+ * @brief state threaded through the copy of the log tail during compaction
+ */
+typedef struct t_compact_tail {
+    FILE *out;
+    t_keydir *keydir;
+    long out_offset;
+    bool failed;
+} t_compact_tail;
+
+/**
+ * @brief state threaded through the liveness filter of a time range scan
+ */
+typedef struct t_live_filter {
+    t_msg_record_visitor visitor;
+    void *arg;
+    int visited;
+} t_live_filter;
+
+static char store_file[PATH_MAX];
+static int read_fd = -1;
+static int append_fd = -1;
+static int lock_fd = -1; // lock file shared by every process writing to the store
+static int writer_lock_depth = 0;
+static long file_bytes = 0;
+static t_keydir keydir;
+static bool opened = false;
+static bool owns_time_index = false;
+static bool compacting = false;
+static int compactions = 0;
+static long truncated_bytes = 0;
+static int recovery_threads = 0; // 0: one per core
+static int *untracked_pending = NULL; // live undelivered ids past the delivery bitmap, ascending
+static int untracked_pending_count = 0;
+static int untracked_pending_cap = 0;
+
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t compactor_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t compactor_thread;
+static bool compactor_running = false;
+static bool compactor_stop = false;
+static double compact_garbage_ratio = 0.5;
+static long compact_min_garbage = 0;
+
+
+static unsigned int keydir_hash(int id) {
+    return (unsigned int)id * 2654435761u;
+}
+
+static int keydir_init(t_keydir *kd, int size) {
+    kd->slots = (t_keydir_entry *)calloc(size, sizeof(t_keydir_entry));
+    if (!kd->slots) {
+        fprintf(stderr, "Error: Memory allocation failed for store keydir.\n");
+        return -1;
+    }
+    kd->size = size;
+    kd->used = 0;
+    kd->filled = 0;
+    kd->live_bytes = 0;
+    kd->garbage_bytes = 0;
+    return 0;
+}
+
+static void keydir_free(t_keydir *kd) {
+    free(kd->slots);
+    kd->slots = NULL;
+    kd->size = kd->used = kd->filled = 0;
+}
+
+static t_keydir_entry *keydir_find(const t_keydir *kd, int id) {
+    if (!kd->slots) return NULL;
+    unsigned int mask = kd->size - 1;
+    for (unsigned int i = keydir_hash(id) & mask; ; i = (i + 1) & mask) {
+        t_keydir_entry *slot = &kd->slots[i];
+        if (slot->state == SLOT_EMPTY) return NULL;
+        if (slot->state == SLOT_USED && slot->id == id) return slot;
+    }
+}
+
+/**
+ * Rehashes the live entries into a table of the given size, dropping deleted slots.
+ */
+static int keydir_resize(t_keydir *kd, int size) {
+    t_keydir_entry *old = kd->slots;
+    int old_size = kd->size;
+    t_keydir_entry *slots = (t_keydir_entry *)calloc(size, sizeof(t_keydir_entry));
+    if (!slots) {
+        fprintf(stderr, "Error: Memory allocation failed for store keydir.\n");
+        return -1;
+    }
+    unsigned int mask = size - 1;
+    for (int i = 0; i < old_size; i++) {
+        if (old[i].state != SLOT_USED) continue;
+        unsigned int j = keydir_hash(old[i].id) & mask;
+        while (slots[j].state != SLOT_EMPTY) {
+            j = (j + 1) & mask;
+        }
+        slots[j] = old[i];
+    }
+    free(old);
+    kd->slots = slots;
+    kd->size = size;
+    kd->filled = kd->used;
+    return 0;
+}
+
+/**
+ * Points an id at a new live record, turning its previous record (if any) into garbage.
+ */
+static int keydir_put(t_keydir *kd, int id, long offset, int length, long long time_sent) {
+    t_keydir_entry *slot = keydir_find(kd, id);
+    if (slot) {
+        kd->live_bytes -= slot->length;
+        kd->garbage_bytes += slot->length;
+    } else {
+        if ((kd->filled + 1) * 10 >= kd->size * 7) {
+            int size = (kd->used + 1) * 10 >= kd->size * 5 ? kd->size * 2 : kd->size;
+            if (keydir_resize(kd, size) != 0) return -1;
+        }
+        unsigned int mask = kd->size - 1;
+        unsigned int i = keydir_hash(id) & mask;
+        while (kd->slots[i].state == SLOT_USED) {
+            i = (i + 1) & mask;
+        }
+        slot = &kd->slots[i];
+        if (slot->state == SLOT_EMPTY) kd->filled++;
+        kd->used++;
+    }
+    *slot = (t_keydir_entry){ .id = id, .state = SLOT_USED, .offset = offset, .length = length, .time_sent = time_sent };
+    kd->live_bytes += length;
+    return 0;
+}
+
+/**
+ * Drops an id from the keydir, turning its record into garbage.
+ */
+static void keydir_remove(t_keydir *kd, int id) {
+    t_keydir_entry *slot = keydir_find(kd, id);
+    if (!slot) return;
+    slot->state = SLOT_DELETED;
+    kd->used--;
+    kd->live_bytes -= slot->length;
+    kd->garbage_bytes += slot->length;
+}
+
+/**
+ * Checks the checksum that ends a record, if it has one. Records written
+ * before checksums were introduced carry none and are accepted as they are.
+ *
+ * @param line The record, including its trailing newline.
+ * @param length Length of the record.
+ * @return 1 if the record is intact, 0 if it is torn or corrupt.
+ */
+static int record_intact(const char *line, int length) {
+    // " ~xxxxxxxx\n"
+    if (length < 11 || line[length - 11] != ' ' || line[length - 10] != STORE_CHECKSUM_MARK) {
+        return 1;
+    }
+    unsigned int stored = 0;
+    for (const char *p = line + length - 9; p < line + length - 1; p++) {
+        int digit = (*p >= '0' && *p <= '9') ? *p - '0' : (*p >= 'a' && *p <= 'f') ? *p - 'a' + 10 : -1;
+        if (digit < 0) return 0;
+        stored = stored << 4 | digit;
+    }
+    return stored == checksum_crc32(line, length - 11);
+}
+
+/**
+ * Appends a checksum to a record, so torn or corrupt writes can be told apart
+ * from real records when the file is read back.
+ *
+ * @param line Buffer holding the record, including its trailing newline.
+ * @param length Length of the record.
+ * @param line_size Size of the buffer.
+ * @return The new length of the record, or -1 if it does not fit in the buffer.
+ */
+int store_seal_record(char *line, int length, int line_size) {
+    if (length < 1 || line[length - 1] != '\n' || length + 10 >= line_size) {
+        return -1;
+    }
+    unsigned int crc = checksum_crc32(line, length - 1);
+    return length - 1 + snprintf(line + length - 1, line_size - length + 1, " %c%08x\n", STORE_CHECKSUM_MARK, crc);
+}
+
+/**
+ * Applies one record of the log to a keydir: a message points its id at the
+ * record, a tombstone removes the id. Tombstones and unreadable lines only
+ * count as garbage.
+ */
+static void apply_record(t_keydir *kd, const char *line, long offset, int length) {
+    if (!record_intact(line, length)) {
+        kd->garbage_bytes += length;
+        return;
+    }
+    int id;
+    long time_sent;
+    if (line[0] == STORE_TOMBSTONE) {
+        if (scan_msg_id(line + 1, line + length, &id)) {
+            keydir_remove(kd, id);
+        }
+        kd->garbage_bytes += length;
+        return;
+    }
+    if (!scan_msg_header(line, line + length, &id, &time_sent)) {
+        kd->garbage_bytes += length;
+        return;
+    }
+    keydir_put(kd, id, offset, length, time_sent);
+}
+
+/**
+ * Reads the complete lines of a file region and hands each one to a handler.
+ *
+ * @param fd File descriptor to read from.
+ * @param from Byte offset to start at (must be the start of a line).
+ * @param to Byte offset to stop at, or -1 to read to the end of the file.
+ * @param handler Function called with each NUL terminated line (including its newline).
+ * @param arg Argument passed through to the handler.
+ * @return The offset just past the last complete line.
+ */
+static long scan_lines(int fd, long from, long to, t_line_handler handler, void *arg) {
+    char *buf = (char *)malloc(SCAN_CHUNK_SIZE + 1);
+    if (!buf) {
+        fprintf(stderr, "Error: Memory allocation failed for store scan buffer.\n");
+        return from;
+    }
+
+    long pos = from; // file offset of buf[0]
+    size_t have = 0;
+    for (;;) {
+        size_t want = SCAN_CHUNK_SIZE - have;
+        if (to >= 0 && (long)(pos + have + want) > to) {
+            want = to - (pos + have);
+        }
+        if (want == 0) break;
+        ssize_t n = pread(fd, buf + have, want, pos + have);
+        if (n <= 0) break;
+        have += n;
+
+        size_t start = 0;
+        char *newline;
+        while ((newline = memchr(buf + start, '\n', have - start)) != NULL) {
+            size_t length = newline - (buf + start) + 1;
+            char saved = buf[start + length];
+            buf[start + length] = '\0';
+            handler(buf + start, pos + start, (int)length, arg);
+            buf[start + length] = saved;
+            start += length;
+        }
+        if (start == 0 && have == SCAN_CHUNK_SIZE) {
+            break; // a line longer than the whole buffer, the file is not a message log
+        }
+        memmove(buf, buf + start, have - start);
+        pos += start;
+        have -= start;
+    }
+    free(buf);
+    return pos;
+}
+
+static void recovery_handler(const char *line, long offset, int length, void *arg) {
+    t_recovery_chunk *chunk = (t_recovery_chunk *)arg;
+    if (!record_intact(line, length)) {
+        chunk->partial.garbage_bytes += length;
+        return;
+    }
+    chunk->intact_end = offset + length;
+
+    int id;
+    long time_sent;
+    if (line[0] == STORE_TOMBSTONE) {
+        if (scan_msg_id(line + 1, line + length, &id)) {
+            keydir_put(&chunk->partial, id, TOMBSTONE_OFFSET, 0, 0);
+        }
+        chunk->partial.garbage_bytes += length;
+    } else if (scan_msg_header(line, line + length, &id, &time_sent)) {
+        keydir_put(&chunk->partial, id, offset, length, time_sent);
+    } else {
+        chunk->partial.garbage_bytes += length;
+    }
+}
+
+static void *recovery_main(void *arg) {
+    t_recovery_chunk *chunk = (t_recovery_chunk *)arg;
+    chunk->scanned_end = scan_lines(chunk->fd, chunk->start, chunk->end, recovery_handler, chunk);
+    return NULL;
+}
+
+/**
+ * Finds the start of the first record at or after an offset.
+ */
+static long next_record_start(int fd, long offset, long file_size) {
+    if (offset <= 0) return 0;
+    char buf[4096];
+    long pos = offset - 1; // a newline right before the offset means it already is a record start
+    while (pos < file_size) {
+        ssize_t n = pread(fd, buf, sizeof(buf), pos);
+        if (n <= 0) break;
+        char *newline = memchr(buf, '\n', n);
+        if (newline) {
+            return pos + (newline - buf) + 1;
+        }
+        pos += n;
+    }
+    return file_size;
+}
+
+/**
+ * Indexes the records from an offset to the end of the file on all cores. The
+ * region is cut into chunks on record boundaries, each thread builds a partial
+ * keydir holding the last event of every id in its chunk, and the partial
+ * keydirs are merged into the store keydir in file order. A torn record at the
+ * end of the file is truncated away.
+ *
+ * @param from Byte offset to start at (must be the start of a record).
+ * @return 0 on success, -1 on failure.
+ */
+static int recover_locked(long from) {
+    struct stat st;
+    if (fstat(read_fd, &st) != 0) return -1;
+    long file_size = (long)st.st_size;
+    if (file_size <= from) {
+        file_bytes = from;
+        return 0;
+    }
+
+    int threads = recovery_threads;
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+        long max_by_size = (file_size - from) / RECOVERY_MIN_CHUNK + 1;
+        if (threads > max_by_size) threads = (int)max_by_size;
+    }
+    if (threads > RECOVERY_MAX_THREADS) threads = RECOVERY_MAX_THREADS;
+
+    t_recovery_chunk chunks[RECOVERY_MAX_THREADS];
+    long start = from;
+    for (int i = 0; i < threads; i++) {
+        long end = (i == threads - 1) ? file_size : next_record_start(read_fd, from + (file_size - from) * (i + 1) / threads, file_size);
+        if (end < start) end = start;
+        chunks[i] = (t_recovery_chunk){ .fd = read_fd, .start = start, .end = end, .scanned_end = start, .intact_end = -1 };
+        start = end;
+    }
+
+    int started = 0;
+    bool failed = false;
+    for (int i = 0; i < threads; i++) {
+        if (keydir_init(&chunks[i].partial, KEYDIR_INITIAL_SIZE) != 0) {
+            failed = true;
+            break;
+        }
+        started++;
+        if (i == threads - 1 || pthread_create(&chunks[i].thread, NULL, recovery_main, &chunks[i]) != 0) {
+            recovery_main(&chunks[i]); // the last chunk (or one we could not hand off) runs here
+            chunks[i].thread = pthread_self();
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        if (!pthread_equal(chunks[i].thread, pthread_self())) {
+            pthread_join(chunks[i].thread, NULL);
+        }
+    }
+
+    // Merge in file order, so later events override earlier ones
+    long intact_end = from;
+    long scanned_end = from;
+    for (int i = 0; i < started && !failed; i++) {
+        t_keydir *partial = &chunks[i].partial;
+        for (int j = 0; j < partial->size; j++) {
+            t_keydir_entry *entry = &partial->slots[j];
+            if (entry->state != SLOT_USED) continue;
+            if (entry->offset == TOMBSTONE_OFFSET) {
+                keydir_remove(&keydir, entry->id);
+            } else {
+                keydir_put(&keydir, entry->id, entry->offset, entry->length, entry->time_sent);
+            }
+        }
+        if (chunks[i].intact_end >= 0) intact_end = chunks[i].intact_end;
+        scanned_end = chunks[i].scanned_end;
+    }
+    for (int i = 0; i < started; i++) {
+        keydir_free(&chunks[i].partial);
+    }
+    if (failed) return -1;
+
+    // Everything past the last intact record is a torn write, cut it off so new records start on a line of their own
+    if (intact_end < file_size) {
+        if (ftruncate(append_fd, intact_end) != 0) {
+            fprintf(stderr, "Error: Unable to truncate torn record at the end of %s.\n", store_file);
+            intact_end = scanned_end;
+        } else {
+            truncated_bytes += file_size - intact_end;
+        }
+    }
+    file_bytes = intact_end;
+    keydir.garbage_bytes = file_bytes - keydir.live_bytes;
+    return 0;
+}
+
+static void hint_path(char *path, size_t size) {
+    snprintf(path, size, "%s%s", store_file, STORE_HINT_SUFFIX);
+}
+
+static unsigned int tail_checksum(long covered_size) {
+    char buf[HINT_TAIL_BYTES];
+    long length = covered_size < HINT_TAIL_BYTES ? covered_size : HINT_TAIL_BYTES;
+    if (length == 0 || pread(read_fd, buf, length, covered_size - length) != length) {
+        return 0;
+    }
+    return checksum_crc32(buf, length);
+}
+
+/**
+ * Writes the keydir next to the message file, so the next open only has to
+ * index records appended after it.
+ */
+static void write_hint_locked(void) {
+    char path[PATH_MAX + sizeof(STORE_HINT_SUFFIX)];
+    char tmp_path[sizeof(path) + 4];
+    hint_path(path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Unable to open file %s for writing.\n", tmp_path);
+        return;
+    }
+    t_hint_header header = { .version = HINT_VERSION, .covered_size = file_bytes, .tail_crc = tail_checksum(file_bytes), .count = keydir.used };
+    memcpy(header.magic, HINT_MAGIC, sizeof(header.magic));
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; i < keydir.size && ok; i++) {
+        t_keydir_entry *entry = &keydir.slots[i];
+        if (entry->state != SLOT_USED) continue;
+        t_hint_entry hint = { .id = entry->id, .length = entry->length, .offset = entry->offset, .time_sent = entry->time_sent };
+        ok = fwrite(&hint, sizeof(hint), 1, file) == 1;
+    }
+    if (fclose(file) != 0) ok = 0;
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Error: Unable to write keydir hint %s.\n", path);
+        remove(tmp_path);
+    }
+}
+
+/**
+ * Loads the keydir from its hint file, if it is present and still describes
+ * a prefix of the message file.
+ *
+ * @return 1 if the hint was loaded, 0 if it is missing or stale.
+ */
+static int load_hint_locked(void) {
+    char path[PATH_MAX + sizeof(STORE_HINT_SUFFIX)];
+    hint_path(path, sizeof(path));
+    FILE *file = fopen(path, "rb");
+    if (!file) return 0;
+
+    struct stat st;
+    t_hint_header header;
+    int ok = fstat(read_fd, &st) == 0
+        && fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, HINT_MAGIC, 4) == 0
+        && header.version == HINT_VERSION
+        && header.count >= 0
+        && header.covered_size <= (long)st.st_size
+        && header.tail_crc == tail_checksum(header.covered_size);
+
+    t_hint_entry hint;
+    for (int i = 0; ok && i < header.count; i++) {
+        ok = fread(&hint, sizeof(hint), 1, file) == 1
+            && hint.offset >= 0 && hint.offset + hint.length <= header.covered_size
+            && keydir_put(&keydir, hint.id, hint.offset, hint.length, hint.time_sent) == 0;
+    }
+    fclose(file);
+
+    if (!ok) {
+        keydir_free(&keydir);
+        keydir_init(&keydir, KEYDIR_INITIAL_SIZE);
+        return 0;
+    }
+    file_bytes = header.covered_size;
+    keydir.garbage_bytes = file_bytes - keydir.live_bytes;
+    return 1;
+}
+
+/**
+ * Replaces the delivery flag read from a record with the one in the delivery
+ * bitmap, which is kept current without rewriting records.
+ */
+static void overlay_delivery(t_message *msg) {
+    int state = delivery_state(msg->identifier);
+    if (state >= 0) msg->delivered = state;
+}
+
+static int read_record_locked(const t_keydir_entry *entry, t_message *msg) {
+    char line[STORE_RECORD_SIZE];
+    if (entry->length >= (int)sizeof(line) || pread(read_fd, line, entry->length, entry->offset) != entry->length) {
+        return 0;
+    }
+    line[entry->length] = '\0';
+    // An offset that no longer points at this message (the file changed under us) must not return another one
+    if (!scan_msg_line(line, line + entry->length, msg) || msg->identifier != entry->id) return 0;
+    overlay_delivery(msg);
+    return 1;
+}
+
+static int compare_int(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static bool delivery_untracked(int identifier) {
+    return identifier < 0 || identifier > DELIVERY_MAX_ID;
+}
+
+/**
+ * Finds the first id not below a given one in the list of untracked undelivered ids.
+ */
+static int untracked_lower_bound(int identifier) {
+    int lo = 0, hi = untracked_pending_count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (untracked_pending[mid] < identifier) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int untracked_reserve(int extra) {
+    if (untracked_pending_count + extra <= untracked_pending_cap) return 0;
+    int cap = untracked_pending_cap ? untracked_pending_cap : 16;
+    while (cap < untracked_pending_count + extra) cap *= 2;
+    int *grown = (int *)realloc(untracked_pending, sizeof(int) * cap);
+    if (!grown) {
+        fprintf(stderr, "Error: Memory allocation failed for undelivered list.\n");
+        return -1;
+    }
+    untracked_pending = grown;
+    untracked_pending_cap = cap;
+    return 0;
+}
+
+/**
+ * Records the delivery flag of a live message: in the delivery bitmap, or,
+ * for an id it cannot track, in the sorted list of those still undelivered.
+ */
+static void note_delivery_locked(int identifier, int delivered) {
+    delivery_note(identifier, delivered);
+    if (!delivery_untracked(identifier)) return;
+    int i = untracked_lower_bound(identifier);
+    bool listed = i < untracked_pending_count && untracked_pending[i] == identifier;
+    if (delivered && listed) {
+        memmove(untracked_pending + i, untracked_pending + i + 1, sizeof(int) * (untracked_pending_count - i - 1));
+        untracked_pending_count--;
+    } else if (!delivered && !listed && untracked_reserve(1) == 0) {
+        memmove(untracked_pending + i + 1, untracked_pending + i, sizeof(int) * (untracked_pending_count - i));
+        untracked_pending[i] = identifier;
+        untracked_pending_count++;
+    }
+}
+
+/**
+ * Drops the delivery flag of a message that is no longer live.
+ */
+static void forget_delivery_locked(int identifier) {
+    delivery_forget(identifier);
+    note_delivery_locked(identifier, 1); // takes it off the untracked list
+}
+
+/**
+ * Brings the delivery bitmap in line with the keydir: messages it does not
+ * track yet take the flag from their record, and messages no longer live are
+ * dropped. Marks made through the bitmap are kept. The list of untracked
+ * undelivered ids is rebuilt from the records along the way.
+ */
+static void reconcile_delivery_locked(void) {
+    int *ids = (int *)malloc(sizeof(int) * (keydir.used > 0 ? keydir.used : 1));
+    if (!ids) {
+        fprintf(stderr, "Error: Memory allocation failed for delivery bitmap.\n");
+        return;
+    }
+    int count = 0;
+    untracked_pending_count = 0;
+    t_message msg;
+    for (int i = 0; i < keydir.size; i++) {
+        t_keydir_entry *entry = &keydir.slots[i];
+        if (entry->state != SLOT_USED) continue;
+        ids[count++] = entry->id;
+        if (delivery_state(entry->id) < 0 && read_record_locked(entry, &msg)) {
+            delivery_note(entry->id, msg.delivered);
+            if (delivery_untracked(entry->id) && !msg.delivered && untracked_reserve(1) == 0) {
+                untracked_pending[untracked_pending_count++] = entry->id;
+            }
+        }
+    }
+    if (untracked_pending_count > 1) qsort(untracked_pending, untracked_pending_count, sizeof(int), compare_int);
+    delivery_retain(ids, count);
+    free(ids);
+}
+
+/**
+ * Takes the lock file that serialises writers across processes, so that
+ * catching up with the file and appending to it happen as one step. Nests,
+ * so a reopen while writing keeps the lock.
+ */
+static void lock_writers_locked(void) {
+    if (writer_lock_depth++ > 0 || lock_fd < 0) return;
+    while (flock(lock_fd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+}
+
+static void unlock_writers_locked(void) {
+    if (--writer_lock_depth > 0 || lock_fd < 0) return;
+    flock(lock_fd, LOCK_UN);
+}
+
+static void close_locked(void) {
+    if (opened) {
+        write_hint_locked();
+    }
+    if (owns_time_index && time_index_is_open()) {
+        time_index_close();
+    }
+    owns_time_index = false;
+    delivery_close();
+    if (read_fd >= 0) close(read_fd);
+    if (append_fd >= 0) close(append_fd);
+    read_fd = append_fd = -1;
+    keydir_free(&keydir);
+    free(untracked_pending);
+    untracked_pending = NULL;
+    untracked_pending_count = untracked_pending_cap = 0;
+    file_bytes = 0;
+    opened = false;
+}
+
+static int open_locked(const char *path) {
+    close_locked();
+    if (lock_fd >= 0 && strcmp(path, store_file) != 0) {
+        close(lock_fd);
+        lock_fd = -1;
+    }
+    snprintf(store_file, sizeof(store_file), "%s", path);
+    truncated_bytes = 0;
+    msg_index_reset(); // the secondary index described the previous store, rebuild it on next query
+
+    if (lock_fd < 0) {
+        char lock_path[sizeof(store_file) + sizeof(STORE_LOCK_SUFFIX)];
+        snprintf(lock_path, sizeof(lock_path), "%s%s", store_file, STORE_LOCK_SUFFIX);
+        lock_fd = open(lock_path, O_RDWR | O_CREAT, 0644);
+    }
+    append_fd = open(store_file, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    read_fd = open(store_file, O_RDONLY);
+    if (lock_fd < 0 || append_fd < 0 || read_fd < 0 || keydir_init(&keydir, KEYDIR_INITIAL_SIZE) != 0) {
+        fprintf(stderr, "Error: Unable to open message store %s.\n", store_file);
+        close_locked();
+        return -1;
+    }
+
+    // Start from the hint when it is usable, and index whatever was appended after it.
+    // Recovery may cut off a torn record, which must not be one another process is still writing.
+    lock_writers_locked();
+    long from = load_hint_locked() ? file_bytes : 0;
+    int rc = recover_locked(from);
+    unlock_writers_locked();
+    if (rc != 0) {
+        fprintf(stderr, "Error: Unable to index message store %s.\n", store_file);
+        close_locked();
+        return -1;
+    }
+    opened = true;
+
+    // A delivery bitmap that already exists is kept current from now on
+    if (delivery_open(store_file, false) >= 0) reconcile_delivery_locked();
+    return 0;
+}
+
+static int ensure_open_locked(void) {
+    if (opened) return 0;
+    return open_locked(MESSAGE_STORE_FILE);
+}
+
+/**
+ * Keeps the secondary index in step with records another process appended.
+ */
+static void catch_up_handler(const char *line, long offset, int length, void *arg) {
+    t_message old_msg, msg;
+    int id;
+    bool is_tombstone = line[0] == STORE_TOMBSTONE;
+    if (is_tombstone ? !scan_msg_id(line + 1, line + length, &id) : !scan_msg_line(line, line + length, &msg)) {
+        apply_record(&keydir, line, offset, length);
+        return;
+    }
+    if (!is_tombstone) id = msg.identifier;
+
+    t_keydir_entry *entry = keydir_find(&keydir, id);
+    if (entry && read_record_locked(entry, &old_msg)) {
+        msg_index_remove(&old_msg);
+    }
+    apply_record(&keydir, line, offset, length);
+    if (!is_tombstone) {
+        msg_index_add(&msg);
+        note_delivery_locked(id, msg.delivered);
+    } else {
+        forget_delivery_locked(id);
+    }
+}
+
+/**
+ * Opens the store again after another process compacted it and renamed a new
+ * file over it. Nothing known about the old file holds for the new one, so
+ * the keydir is rebuilt without saving a hint and the indexes are dropped.
+ */
+static int reopen_locked(void) {
+    char path[sizeof(store_file)];
+    snprintf(path, sizeof(path), "%s", store_file);
+    opened = false;
+    return open_locked(path);
+}
+
+/**
+ * Applies any records appended to the file by someone else since we last
+ * looked, first switching to the new file if the store was compacted.
+ */
+static void catch_up_locked(void) {
+    struct stat st, current;
+    if (fstat(read_fd, &st) != 0) {
+        return;
+    }
+    if (stat(store_file, &current) == 0 && (current.st_ino != st.st_ino || current.st_dev != st.st_dev)) {
+        reopen_locked();
+        return;
+    }
+    if ((long)st.st_size > file_bytes) {
+        file_bytes = scan_lines(read_fd, file_bytes, -1, catch_up_handler, NULL);
+    }
+}
+
+/**
+ * Locks out writers in other processes and applies what they appended,
+ * so the next append lands where file_bytes says. Undo with unlock_writers_locked.
+ */
+static void begin_write_locked(void) {
+    lock_writers_locked();
+    catch_up_locked();
+}
+
+/**
+ * Accounts for data just appended, from where the write actually ended.
+ *
+ * @param length Number of bytes written.
+ * @return Byte offset the data was written at.
+ */
+static long appended_locked(long length) {
+    long end = (long)lseek(append_fd, 0, SEEK_CUR);
+    if (end < length) {
+        end = file_bytes + length;
+    }
+    // A writer that bypassed the lock file appended first: leave file_bytes so catch up reads its records (and ours, harmlessly)
+    if (end - length == file_bytes) {
+        file_bytes = end;
+    }
+    return end - length;
+}
+
+static int append_locked(const char *line, int length, long *offset) {
+    if (write(append_fd, line, length) != length) {
+        fprintf(stderr, "Error: Unable to append to message store %s.\n", store_file);
+        return -1;
+    }
+    *offset = appended_locked(length);
+    return 0;
+}
+
+static bool should_compact_locked(void) {
+    return file_bytes > 0
+        && keydir.garbage_bytes >= compact_min_garbage
+        && (double)keydir.garbage_bytes / file_bytes >= compact_garbage_ratio;
+}
+
+static void signal_compactor_locked(void) {
+    if (compactor_running && should_compact_locked()) {
+        pthread_cond_signal(&compactor_cond);
+    }
+}
+
+/**
+ * Opens a message store. The keydir is loaded from its hint file when that is
+ * up to date, and otherwise rebuilt from the log in parallel.
+ *
+ * @param path Path to the message file (created if missing).
+ * @return 0 on success, -1 on failure.
+ */
+int store_open(const char *path) {
+    pthread_mutex_lock(&store_lock);
+    int rc = open_locked(path);
+    pthread_mutex_unlock(&store_lock);
+    return rc;
+}
+
+/**
+ * Sets how many threads index the message file when it is opened without a usable hint.
+ *
+ * @param threads Number of threads, or 0 for one per core (fewer for small files).
+ */
+void store_set_recovery_threads(int threads) {
+    pthread_mutex_lock(&store_lock);
+    recovery_threads = threads;
+    pthread_mutex_unlock(&store_lock);
+}
+
+/**
+ * Stops the compactor and closes the message store.
+ */
+void store_close(void) {
+    store_stop_compactor();
+    pthread_mutex_lock(&store_lock);
+    close_locked();
+    if (lock_fd >= 0) {
+        close(lock_fd);
+        lock_fd = -1;
+    }
+    pthread_mutex_unlock(&store_lock);
+}
+
+/**
+ * Reads the live version of a message. The default store is opened on first use.
+ *
+ * @param identifier The unique identifier of the message.
+ * @param msg Pointer to the message to fill in.
+ * @return 1 if the message was found, 0 otherwise.
+ */
+int store_get(int identifier, t_message *msg) {
+    pthread_mutex_lock(&store_lock);
+    int found = 0;
+    if (ensure_open_locked() == 0) {
+        t_keydir_entry *entry = keydir_find(&keydir, identifier);
+        if (!entry) {
+            catch_up_locked();
+            entry = keydir_find(&keydir, identifier);
+        }
+        found = entry ? read_record_locked(entry, msg) : 0;
+    }
+    pthread_mutex_unlock(&store_lock);
+    return found;
+}
+
+static int compare_entry_offset(const void *a, const void *b) {
+    const t_keydir_entry *ea = *(const t_keydir_entry *const *)a;
+    const t_keydir_entry *eb = *(const t_keydir_entry *const *)b;
+    return (ea->offset > eb->offset) - (ea->offset < eb->offset);
+}
+
+/**
+ * Reads the live versions of several messages. Records that lie close
+ * together in the file, as neighbouring ids usually do, are fetched with a
+ * single read.
+ *
+ * @param identifiers The unique identifiers of the messages.
+ * @param count Number of identifiers.
+ * @param msgs Array of count messages to fill in.
+ * @param found Array of count flags, set for each message that was read.
+ * @return Number of messages read.
+ */
+int store_get_batch(const int *identifiers, int count, t_message *msgs, bool *found) {
+    if (count <= 0) return 0;
+    memset(found, 0, sizeof(bool) * count);
+    t_keydir_entry **entries = (t_keydir_entry **)malloc(sizeof(t_keydir_entry *) * count);
+    char *buffer = (char *)malloc(BATCH_MAX_SPAN);
+    if (!entries || !buffer) {
+        fprintf(stderr, "Error: Memory allocation failed for batch read.\n");
+        free(entries);
+        free(buffer);
+        return 0;
+    }
+
+    pthread_mutex_lock(&store_lock);
+    int located = 0, read = 0;
+    if (ensure_open_locked() == 0) {
+        catch_up_locked();
+        for (int i = 0; i < count; i++) {
+            t_keydir_entry *entry = keydir_find(&keydir, identifiers[i]);
+            if (entry) entries[located++] = entry;
+        }
+    }
+    qsort(entries, located, sizeof(t_keydir_entry *), compare_entry_offset);
+
+    // Walk the records in file order, one read per run that fits the buffer
+    char line[STORE_RECORD_SIZE];
+    for (int first = 0; first < located; ) {
+        long start = entries[first]->offset;
+        int last = first;
+        while (last + 1 < located && entries[last + 1]->offset + entries[last + 1]->length - start <= BATCH_MAX_SPAN) {
+            last++;
+        }
+        long span = entries[last]->offset + entries[last]->length - start;
+        bool loaded = span <= BATCH_MAX_SPAN && pread(read_fd, buffer, span, start) == span;
+        for (int e = first; e <= last; e++) {
+            t_keydir_entry *entry = entries[e];
+            t_message msg;
+            bool ok;
+            if (loaded && entry->length < (int)sizeof(line)) {
+                memcpy(line, buffer + (entry->offset - start), entry->length);
+                line[entry->length] = '\0';
+                ok = scan_msg_line(line, line + entry->length, &msg);
+            } else {
+                ok = read_record_locked(entry, &msg);
+            }
+            if (ok) overlay_delivery(&msg);
+            for (int i = 0; ok && i < count; i++) {
+                if (!found[i] && identifiers[i] == entry->id) {
+                    msgs[i] = msg;
+                    found[i] = true;
+                    read++;
+                }
+            }
+        }
+        first = last + 1;
+    }
+    pthread_mutex_unlock(&store_lock);
+
+    free(entries);
+    free(buffer);
+    return read;
+}
+
+/**
+ * Tells whether a message is live in the store.
+ *
+ * @param identifier The unique identifier of the message.
+ * @return 1 if the message is live, 0 otherwise.
+ */
+int store_contains(int identifier) {
+    pthread_mutex_lock(&store_lock);
+    int found = 0;
+    if (ensure_open_locked() == 0) {
+        catch_up_locked();
+        found = keydir_find(&keydir, identifier) != NULL;
+    }
+    pthread_mutex_unlock(&store_lock);
+    return found;
+}
+
+/**
+ * Appends a message to the store unless it is already there.
+ *
+ * @param msg Pointer to the message.
+ * @return 1 if the message was appended, 0 if it already exists, -1 on failure.
+ */
+int store_insert(const t_message *msg) {
+    char line[STORE_RECORD_SIZE];
+    int length = format_msg_line(msg, line, sizeof(line));
+    if (length < 0 || (length = store_seal_record(line, length, sizeof(line))) < 0) return -1;
+
+    pthread_mutex_lock(&store_lock);
+    int rc = -1;
+    long offset;
+    if (ensure_open_locked() == 0) {
+        begin_write_locked();
+        if (keydir_find(&keydir, msg->identifier)) {
+            rc = 0;
+        } else if (append_locked(line, length, &offset) == 0 && keydir_put(&keydir, msg->identifier, offset, length, msg->time_sent) == 0) {
+            msg_index_add(msg);
+            time_index_append(msg, offset, offset + length);
+            note_delivery_locked(msg->identifier, msg->delivered);
+            rc = 1;
+        }
+        unlock_writers_locked();
+    }
+    pthread_mutex_unlock(&store_lock);
+    return rc;
+}
+
+/**
+ * @brief an id and its position in a batch, sorted to find repeated ids
+ */
+typedef struct t_batch_id {
+    int id;
+    int index;
+} t_batch_id;
+
+static int compare_batch_id(const void *a, const void *b) {
+    const t_batch_id *ba = (const t_batch_id *)a;
+    const t_batch_id *bb = (const t_batch_id *)b;
+    if (ba->id != bb->id) return (ba->id > bb->id) - (ba->id < bb->id);
+    return ba->index - bb->index;
+}
+
+static int write_all(int fd, const char *data, long length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n <= 0) return -1;
+        data += n;
+        length -= n;
+    }
+    return 0;
+}
+
+/**
+ * Appends many messages with one write, skipping those already in the store
+ * (or earlier in the batch). Records are encoded before the store is locked,
+ * and the keydir and indexes are updated in one pass afterwards.
+ *
+ * @param msgs Array of messages.
+ * @param count Number of messages.
+ * @param results Array of count results: 1 appended, 0 already exists, -1 could not be encoded.
+ * @return Number of messages appended, or -1 if the write failed.
+ */
+int store_insert_batch(const t_message *msgs, int count, int *results) {
+    if (count <= 0) return 0;
+    char *data = (char *)malloc((size_t)count * STORE_RECORD_SIZE);
+    int *starts = (int *)malloc(sizeof(int) * count);
+    int *lengths = (int *)malloc(sizeof(int) * count);
+    t_batch_id *ids = (t_batch_id *)malloc(sizeof(t_batch_id) * count);
+    if (!data || !starts || !lengths || !ids) {
+        fprintf(stderr, "Error: Memory allocation failed for batch insert.\n");
+        free(data);
+        free(starts);
+        free(lengths);
+        free(ids);
+        return -1;
+    }
+
+    long used = 0;
+    for (int i = 0; i < count; i++) {
+        char *line = data + used;
+        int length = format_msg_line(&msgs[i], line, STORE_RECORD_SIZE);
+        if (length >= 0) length = store_seal_record(line, length, STORE_RECORD_SIZE);
+        starts[i] = used;
+        lengths[i] = length;
+        results[i] = length < 0 ? -1 : 1;
+        if (length > 0) used += length;
+        ids[i] = (t_batch_id){ msgs[i].identifier, i };
+    }
+
+    // Only the first occurrence of an id within the batch is kept
+    qsort(ids, count, sizeof(t_batch_id), compare_batch_id);
+    for (int i = 1; i < count; i++) {
+        if (ids[i].id == ids[i - 1].id && results[ids[i].index] == 1) results[ids[i].index] = 0;
+    }
+
+    pthread_mutex_lock(&store_lock);
+    int appended = -1;
+    if (ensure_open_locked() == 0) {
+        begin_write_locked();
+        // Squeeze out duplicates so the rest goes out in one write
+        long kept = 0;
+        for (int i = 0; i < count; i++) {
+            if (results[i] == 1 && keydir_find(&keydir, msgs[i].identifier)) results[i] = 0;
+            if (results[i] != 1) continue;
+            if (kept != starts[i]) memmove(data + kept, data + starts[i], lengths[i]);
+            starts[i] = kept;
+            kept += lengths[i];
+        }
+
+        if (write_all(append_fd, data, kept) != 0) {
+            fprintf(stderr, "Error: Unable to append to message store %s.\n", store_file);
+            catch_up_locked(); // index whatever part of the batch did reach the file
+            for (int i = 0; i < count; i++) {
+                if (results[i] == 1) results[i] = -1;
+            }
+        } else {
+            long base = appended_locked(kept);
+            // Grow the keydir once for the whole batch instead of doubling repeatedly
+            int size = keydir.size;
+            while ((keydir.used + count) * 10 >= size * 5) size *= 2;
+            if (size != keydir.size) keydir_resize(&keydir, size);
+            appended = 0;
+            for (int i = 0; i < count; i++) {
+                if (results[i] != 1) continue;
+                long offset = base + starts[i];
+                if (keydir_put(&keydir, msgs[i].identifier, offset, lengths[i], msgs[i].time_sent) != 0) {
+                    results[i] = -1;
+                    continue;
+                }
+                time_index_append(&msgs[i], offset, offset + lengths[i]);
+                note_delivery_locked(msgs[i].identifier, msgs[i].delivered);
+                appended++;
+            }
+            msg_index_add_batch(msgs, results, count);
+        }
+        unlock_writers_locked();
+    }
+    pthread_mutex_unlock(&store_lock);
+
+    free(data);
+    free(starts);
+    free(lengths);
+    free(ids);
+    return appended;
+}
+
+/**
+ * Appends the new version of a live message and points the keydir and
+ * indexes at it. The store must be open and caught up.
+ *
+ * @return 0 on success, -1 if the message does not exist or on failure.
+ */
+static int update_locked(const t_message *msg) {
+    char line[STORE_RECORD_SIZE];
+    int length = format_msg_line(msg, line, sizeof(line));
+    if (length < 0 || (length = store_seal_record(line, length, sizeof(line))) < 0) return -1;
+
+    long offset;
+    t_message old_msg;
+    t_keydir_entry *entry = keydir_find(&keydir, msg->identifier);
+    if (!entry || !read_record_locked(entry, &old_msg)
+            || append_locked(line, length, &offset) != 0
+            || keydir_put(&keydir, msg->identifier, offset, length, msg->time_sent) != 0) {
+        return -1;
+    }
+    msg_index_remove(&old_msg);
+    msg_index_add(msg);
+    time_index_append(msg, offset, offset + length);
+    note_delivery_locked(msg->identifier, msg->delivered);
+    signal_compactor_locked();
+    return 0;
+}
+
+/**
+ * Replaces a live message by appending its new version.
+ *
+ * @param msg Pointer to the new version of the message.
+ * @return 0 on success, -1 if the message does not exist or on failure.
+ */
+int store_update(const t_message *msg) {
+    pthread_mutex_lock(&store_lock);
+    int rc = -1;
+    if (ensure_open_locked() == 0) {
+        begin_write_locked();
+        rc = update_locked(msg);
+        unlock_writers_locked();
+    }
+    pthread_mutex_unlock(&store_lock);
+    return rc;
+}
+
+/**
+ * Deletes a live message by appending a tombstone.
+ *
+ * @param identifier The unique identifier of the message.
+ * @return 0 on success, -1 if the message does not exist or on failure.
+ */
+int store_delete(int identifier) {
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%c %d %lld\n", STORE_TOMBSTONE, identifier, current_timestamp_ms());
+    length = store_seal_record(line, length, sizeof(line));
+
+    pthread_mutex_lock(&store_lock);
+    int rc = -1;
+    long offset;
+    t_message old_msg;
+    if (ensure_open_locked() == 0) {
+        begin_write_locked();
+        t_keydir_entry *entry = keydir_find(&keydir, identifier);
+        if (entry && read_record_locked(entry, &old_msg) && append_locked(line, length, &offset) == 0) {
+            apply_record(&keydir, line, offset, length);
+            msg_index_remove(&old_msg);
+            forget_delivery_locked(identifier);
+            signal_compactor_locked();
+            rc = 0;
+        }
+        unlock_writers_locked();
+    }
+    pthread_mutex_unlock(&store_lock);
+    return rc;
+}
+
+static int compare_entry_id(const void *a, const void *b) {
+    const t_keydir_entry *x = (const t_keydir_entry *)a;
+    const t_keydir_entry *y = (const t_keydir_entry *)b;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+static int compare_entry_time(const void *a, const void *b) {
+    const t_keydir_entry *x = (const t_keydir_entry *)a;
+    const t_keydir_entry *y = (const t_keydir_entry *)b;
+    if (x->time_sent != y->time_sent) {
+        return (x->time_sent > y->time_sent) - (x->time_sent < y->time_sent);
+    }
+    return compare_entry_id(a, b);
+}
+
+/**
+ * Copies the live entries of the keydir into a new array.
+ *
+ * @param count Set to the number of entries copied.
+ * @return The array (NULL if empty or on failure). The caller is responsible for freeing it.
+ */
+static t_keydir_entry *snapshot_locked(int *count) {
+    *count = 0;
+    if (keydir.used == 0) return NULL;
+    t_keydir_entry *entries = (t_keydir_entry *)malloc(keydir.used * sizeof(t_keydir_entry));
+    if (!entries) {
+        fprintf(stderr, "Error: Memory allocation failed for store snapshot.\n");
+        return NULL;
+    }
+    for (int i = 0; i < keydir.size; i++) {
+        if (keydir.slots[i].state == SLOT_USED) {
+            entries[(*count)++] = keydir.slots[i];
+        }
+    }
+    return entries;
+}
+
+/**
+ * Visits the live version of every message, in id order. The visitor runs
+ * with the store locked and must not call back into the store.
+ *
+ * @param visitor Function called with each message and its byte offset.
+ * @param arg Argument passed through to the visitor.
+ * @return The number of messages visited, or -1 on failure.
+ */
+int store_foreach(t_msg_record_visitor visitor, void *arg) {
+    pthread_mutex_lock(&store_lock);
+    if (ensure_open_locked() != 0) {
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+    catch_up_locked();
+
+    int count;
+    t_keydir_entry *entries = snapshot_locked(&count);
+    qsort(entries, count, sizeof(t_keydir_entry), compare_entry_id);
+    int visited = 0;
+    t_message msg;
+    for (int i = 0; i < count; i++) {
+        if (read_record_locked(&entries[i], &msg)) {
+            visitor(&msg, entries[i].offset, arg);
+            visited++;
+        }
+    }
+    free(entries);
+    pthread_mutex_unlock(&store_lock);
+    return visited;
+}
+
+static void live_filter_visitor(const t_message *msg, long offset, void *arg) {
+    t_live_filter *filter = (t_live_filter *)arg;
+    t_keydir_entry *entry = keydir_find(&keydir, msg->identifier);
+    if (entry && entry->offset == offset) {
+        t_message current = *msg;
+        overlay_delivery(&current);
+        filter->visitor(&current, offset, filter->arg);
+        filter->visited++;
+    }
+}
+
+/**
+ * Streams the live messages with time_sent in [t_start, t_end] through the
+ * time index, skipping superseded and deleted records.
+ *
+ * @param t_start Start of the time range (inclusive).
+ * @param t_end End of the time range (inclusive).
+ * @param visitor Function called with each matching message and its byte offset.
+ * @param arg Argument passed through to the visitor.
+ * @return The number of messages visited, or -1 on failure.
+ */
+int store_scan_time(long long t_start, long long t_end, t_msg_record_visitor visitor, void *arg) {
+    pthread_mutex_lock(&store_lock);
+    if (ensure_open_locked() != 0) {
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+    catch_up_locked();
+    if (!owns_time_index || !time_index_is_open()) {
+        time_index_open(store_file);
+        owns_time_index = true;
+    }
+
+    t_live_filter filter = { .visitor = visitor, .arg = arg, .visited = 0 };
+    int rc = time_index_scan(t_start, t_end, live_filter_visitor, &filter);
+    pthread_mutex_unlock(&store_lock);
+    return rc < 0 ? -1 : filter.visited;
+}
+
+/**
+ * Opens the delivery bitmap on first use, creating it from the records if needed.
+ */
+static int ensure_delivery_locked(void) {
+    if (delivery_is_open()) return 0;
+    if (delivery_open(store_file, true) < 0) return -1;
+    reconcile_delivery_locked();
+    return 0;
+}
+
+/**
+ * Marks a live message the bitmap cannot track (its id is past
+ * DELIVERY_MAX_ID) as delivered, the way it was before the bitmap: by
+ * appending a new version of its record.
+ *
+ * @return 1 if newly marked, 0 if already delivered, -1 on failure.
+ */
+static int mark_untracked_locked(t_keydir_entry *entry) {
+    t_message msg;
+    if (!read_record_locked(entry, &msg)) return -1;
+    if (msg.delivered) return 0;
+    msg.delivered = 1;
+    return update_locked(&msg) == 0 ? 1 : -1;
+}
+
+/**
+ * Marks messages as delivered in the delivery bitmap, without rewriting
+ * their records. The secondary index is moved along with each change.
+ * Messages with ids past DELIVERY_MAX_ID have their record rewritten instead.
+ *
+ * @param identifiers The unique identifiers of the messages.
+ * @param count Number of identifiers.
+ * @param results Array of count results: 1 newly marked, 0 already delivered, -1 not in the store. May be NULL.
+ * @return Number of messages newly marked, or -1 on failure.
+ */
+int store_mark_delivered(const int *identifiers, int count, int *results) {
+    pthread_mutex_lock(&store_lock);
+    int marked = -1;
+    if (ensure_open_locked() == 0) {
+        begin_write_locked();
+        if (ensure_delivery_locked() == 0) {
+            marked = 0;
+            for (int i = 0; i < count; i++) {
+                t_keydir_entry *entry = keydir_find(&keydir, identifiers[i]);
+                int rc = -1;
+                if (entry) {
+                    rc = delivery_set(identifiers[i], 1);
+                    if (rc == 1) msg_index_set_delivered(identifiers[i], 1);
+                    else if (rc < 0) rc = mark_untracked_locked(entry); // moves the index itself
+                }
+                if (rc == 1) marked++;
+                if (results) results[i] = rc;
+            }
+            delivery_sync();
+        }
+        unlock_writers_locked();
+    }
+    pthread_mutex_unlock(&store_lock);
+    return marked;
+}
+
+/**
+ * Finds the next undelivered messages, in id order, from the delivery bitmap
+ * and then from the records of the messages it does not track.
+ *
+ * @param cursor The first id to look at; advanced past the last id returned. Start at 0.
+ * @param identifiers Array of max ids to fill in.
+ * @param max Most ids to return.
+ * @return Number of ids returned (0 once every id was seen), or -1 on failure.
+ */
+int store_next_undelivered(int *cursor, int *identifiers, int max) {
+    pthread_mutex_lock(&store_lock);
+    int found = -1;
+    if (ensure_open_locked() == 0) {
+        catch_up_locked();
+        if (ensure_delivery_locked() == 0) {
+            found = delivery_next_undelivered(cursor, identifiers, max);
+            if (found < max && *cursor < INT_MAX) {
+                // Past the bitmap: the untracked messages, with INT_MAX marking the end
+                int start = untracked_lower_bound(*cursor);
+                int count = untracked_pending_count - start;
+                int taken = count < max - found ? count : max - found;
+                if (taken > 0) memcpy(identifiers + found, untracked_pending + start, sizeof(int) * taken);
+                found += taken;
+                *cursor = taken < count ? untracked_pending[start + taken - 1] + 1 : INT_MAX;
+            }
+        }
+    }
+    pthread_mutex_unlock(&store_lock);
+    return found;
+}
+
+/**
+ * Counts the undelivered messages in the store.
+ *
+ * @return The count, or -1 on failure.
+ */
+long store_count_undelivered(void) {
+    pthread_mutex_lock(&store_lock);
+    long count = -1;
+    if (ensure_open_locked() == 0) {
+        catch_up_locked();
+        if (ensure_delivery_locked() == 0) {
+            count = delivery_count_undelivered() + untracked_pending_count;
+        }
+    }
+    pthread_mutex_unlock(&store_lock);
+    return count;
+}
+
+static void compact_tail_handler(const char *line, long offset, int length, void *arg) {
+    t_compact_tail *tail = (t_compact_tail *)arg;
+    if (fwrite(line, 1, length, tail->out) != (size_t)length) {
+        tail->failed = true;
+    }
+    apply_record(tail->keydir, line, tail->out_offset, length);
+    tail->out_offset += length;
+}
+
+/**
+ * Rewrites the live records into a fresh file, in time order, and atomically
+ * swaps it in. Records are copied without holding the store lock; whatever was
+ * appended meanwhile is replayed onto the new file just before the swap.
+ *
+ * @return 0 on success, -1 on failure or if a compaction is already running.
+ */
+int store_compact(void) {
+    pthread_mutex_lock(&store_lock);
+    if (ensure_open_locked() != 0 || compacting) {
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+    compacting = true;
+    catch_up_locked();
+    int count;
+    t_keydir_entry *entries = snapshot_locked(&count);
+    long snapshot_end = file_bytes;
+    struct stat snapshot_st;
+    int fd = fstat(read_fd, &snapshot_st) == 0 ? dup(read_fd) : -1;
+    pthread_mutex_unlock(&store_lock);
+
+    char compact_file[sizeof(store_file) + sizeof(STORE_COMPACT_SUFFIX)];
+    snprintf(compact_file, sizeof(compact_file), "%s%s", store_file, STORE_COMPACT_SUFFIX);
+    FILE *out = fd >= 0 ? fopen(compact_file, "w") : NULL;
+    t_keydir fresh = { 0 };
+    t_compact_tail tail = { .out = out, .keydir = &fresh, .out_offset = 0, .failed = out == NULL || keydir_init(&fresh, KEYDIR_INITIAL_SIZE) != 0 };
+
+    // Copy the live records of the snapshot, oldest first, so the new file is in time order again
+    qsort(entries, count, sizeof(t_keydir_entry), compare_entry_time);
+    char line[STORE_RECORD_SIZE];
+    for (int i = 0; i < count && !tail.failed; i++) {
+        int length = entries[i].length;
+        if (length >= (int)sizeof(line) || pread(fd, line, length, entries[i].offset) != length || fwrite(line, 1, length, out) != (size_t)length) {
+            tail.failed = true;
+            break;
+        }
+        keydir_put(&fresh, entries[i].id, tail.out_offset, length, entries[i].time_sent);
+        tail.out_offset += length;
+    }
+    free(entries);
+
+    // Writers in other processes wait until they can follow the swap
+    pthread_mutex_lock(&store_lock);
+    lock_writers_locked();
+    if (!tail.failed) {
+        catch_up_locked();
+        struct stat st;
+        if (fstat(read_fd, &st) != 0 || st.st_ino != snapshot_st.st_ino || st.st_dev != snapshot_st.st_dev) {
+            tail.failed = true; // another process compacted the store first
+        } else {
+            scan_lines(read_fd, snapshot_end, file_bytes, compact_tail_handler, &tail);
+        }
+    }
+    if (out) {
+        if (fflush(out) != 0 || fsync(fileno(out)) != 0) tail.failed = true;
+        fclose(out);
+    }
+    if (fd >= 0) close(fd);
+
+    bool close_time_index = owns_time_index && time_index_is_open();
+    char old_hint[PATH_MAX + sizeof(STORE_HINT_SUFFIX)];
+    hint_path(old_hint, sizeof(old_hint));
+    if (!tail.failed) {
+        if (close_time_index) time_index_close();
+        remove(old_hint); // describes the old file, must not survive a crash right after the rename
+        if (rename(compact_file, store_file) != 0) tail.failed = true;
+    }
+    if (tail.failed) {
+        fprintf(stderr, "Error: Compaction of message store %s failed.\n", store_file);
+        remove(compact_file);
+        keydir_free(&fresh);
+        compacting = false;
+        unlock_writers_locked();
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+
+    // The time index still describes the old file, drop it before anyone reads it
+    char index_file[sizeof(store_file) + sizeof(TIME_INDEX_SUFFIX)];
+    snprintf(index_file, sizeof(index_file), "%s%s", store_file, TIME_INDEX_SUFFIX);
+    remove(index_file);
+
+    close(read_fd);
+    close(append_fd);
+    read_fd = open(store_file, O_RDONLY);
+    append_fd = open(store_file, O_WRONLY | O_APPEND);
+    keydir_free(&keydir);
+    keydir = fresh;
+    file_bytes = tail.out_offset;
+    compactions++;
+    compacting = false;
+    write_hint_locked();
+    unlock_writers_locked();
+    // The next time range scan reopens the time index, rebuilding it outside of this swap
+    owns_time_index = false;
+    pthread_mutex_unlock(&store_lock);
+    return 0;
+}
+
+static void *compactor_main(void *arg) {
+    pthread_mutex_lock(&store_lock);
+    while (!compactor_stop) {
+        if (opened && !compacting && should_compact_locked()) {
+            pthread_mutex_unlock(&store_lock);
+            int rc = store_compact();
+            pthread_mutex_lock(&store_lock);
+            if (rc == 0) continue;
+        }
+        pthread_cond_wait(&compactor_cond, &store_lock);
+    }
+    pthread_mutex_unlock(&store_lock);
+    return NULL;
+}
+
+/**
+ * Starts a background thread that compacts the store whenever garbage passes a threshold.
+ *
+ * @param garbage_ratio Fraction of the file that must be garbage before compacting.
+ * @param min_garbage_bytes Minimum amount of garbage before compacting.
+ * @return 0 on success, -1 if the compactor is already running or could not be started.
+ */
+int store_start_compactor(double garbage_ratio, long min_garbage_bytes) {
+    pthread_mutex_lock(&store_lock);
+    if (compactor_running) {
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+    compact_garbage_ratio = garbage_ratio;
+    compact_min_garbage = min_garbage_bytes;
+    compactor_stop = false;
+    if (pthread_create(&compactor_thread, NULL, compactor_main, NULL) != 0) {
+        fprintf(stderr, "Error: Unable to start the store compactor.\n");
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+    compactor_running = true;
+    pthread_mutex_unlock(&store_lock);
+    return 0;
+}
+
+/**
+ * Stops the background compactor, waiting for a running compaction to finish.
+ */
+void store_stop_compactor(void) {
+    pthread_mutex_lock(&store_lock);
+    if (!compactor_running) {
+        pthread_mutex_unlock(&store_lock);
+        return;
+    }
+    compactor_stop = true;
+    pthread_cond_signal(&compactor_cond);
+    pthread_mutex_unlock(&store_lock);
+
+    pthread_join(compactor_thread, NULL);
+    pthread_mutex_lock(&store_lock);
+    compactor_running = false;
+    pthread_mutex_unlock(&store_lock);
+}
+
+/**
+ * Reports how much of the message file is live.
+ *
+ * @param stats Pointer to the statistics to fill in.
+ */
+void store_get_stats(t_store_stats *stats) {
+    pthread_mutex_lock(&store_lock);
+    if (ensure_open_locked() == 0) {
+        catch_up_locked();
+    }
+    stats->file_bytes = file_bytes;
+    stats->live_bytes = keydir.live_bytes;
+    stats->garbage_bytes = keydir.garbage_bytes;
+    stats->live_records = keydir.used;
+    stats->compactions = compactions;
+    stats->truncated_bytes = truncated_bytes;
+    pthread_mutex_unlock(&store_lock);
+}
@@ -0,0 +1,53 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include "message.h"
+#include "time_index.h"
+
+#include <stdbool.h>
+
+#define STORE_TOMBSTONE 'D'
+#define STORE_CHECKSUM_MARK '~'
+#define STORE_COMPACT_SUFFIX ".compact"
+#define STORE_HINT_SUFFIX ".kdx"
+#define STORE_LOCK_SUFFIX ".lock"
+#define STORE_RECORD_SIZE 2048
+
+/**
+ * @brief counters describing how much of the message file is still live
+ */
+typedef struct t_store_stats {
+    long file_bytes;
+    long live_bytes;
+    long garbage_bytes; // superseded records and tombstones
+    int live_records;
+    int compactions;
+    long truncated_bytes; // torn records cut off the end of the file when it was opened
+} t_store_stats;
+
+int store_open(const char *path);
+void store_close(void);
+void store_set_recovery_threads(int threads);
+int store_seal_record(char *line, int length, int line_size);
+
+int store_get(int identifier, t_message *msg);
+int store_get_batch(const int *identifiers, int count, t_message *msgs, bool *found);
+int store_contains(int identifier);
+int store_insert(const t_message *msg);
+int store_insert_batch(const t_message *msgs, int count, int *results);
+int store_update(const t_message *msg);
+int store_delete(int identifier);
+
+int store_mark_delivered(const int *identifiers, int count, int *results);
+int store_next_undelivered(int *cursor, int *identifiers, int max);
+long store_count_undelivered(void);
+
+int store_foreach(t_msg_record_visitor visitor, void *arg);
+int store_scan_time(long long t_start, long long t_end, t_msg_record_visitor visitor, void *arg);
+
+int store_compact(void);
+int store_start_compactor(double garbage_ratio, long min_garbage_bytes);
+void store_stop_compactor(void);
+void store_get_stats(t_store_stats *stats);
+
+#endif // STORE_H
@@ -1,6 +1,18 @@
 #include "message.h"
 #include "cache.h"
 #include "utility.h"
+#include "index.h"
+#include "time_index.h"
+#include "store.h"
+#include "cache_server.h"
+#include "cache_client.h"
+#include "shm_cache.h"
+#include "near_cache.h"
+#include "prefetch.h"
+#include "ingest.h"
+#include "msg_scan.h"
+#include "timesource.h"
+#include "delivery.h"
 
 
 #include <stdio.h>
@@ -9,6 +21,9 @@
 #include <unistd.h>
 #include <time.h>
 #include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
 
 
 // Define the size of the hash table for the cache
@@ -23,6 +38,9 @@ t_lru_cache lru_cache;
 // Define the cache count
 int cache_count = 0;
 
+// Scratch message store, so the tests never touch messages.txt
+#define TEST_STORE_FILE "test_messages.txt"
+
 // Define replacement strategies
 #define LRU 0
 #define RANDOM 1
@@ -43,6 +61,24 @@ void test_cache_miss_disk_search();
 void test_cache_miss_not_found();
 void test_lru_eviction();
 void test_random_eviction();
+void test_posting_list_encoding();
+void test_secondary_index_query();
+void test_time_range_scan();
+void test_update_and_delete();
+void test_background_compaction();
+void test_parallel_recovery();
+void test_cache_daemon();
+void test_shm_cache_shared();
+void test_shm_cache_recovery();
+void test_sequential_prefetch();
+void test_bulk_ingest();
+void test_message_parser();
+void test_hit_ratio_curve();
+void test_cache_autosize();
+void test_near_cache();
+void test_time_source();
+void test_delivery_bitmap();
+void test_background_eviction();
 
 // Test runner function
 void run_test(TestCase test) {
@@ -68,13 +104,48 @@ int main() {
         {"Cache Miss and Not Found Test", test_cache_miss_not_found},
         {"LRU Eviction Test", test_lru_eviction},
         {"Random Eviction Test", test_random_eviction},
+        {"Posting List Encoding Test", test_posting_list_encoding},
+        {"Secondary Index Query Test", test_secondary_index_query},
+        {"Time Range Scan Test", test_time_range_scan},
+        {"Update and Delete Test", test_update_and_delete},
+        {"Background Compaction Test", test_background_compaction},
+        {"Parallel Recovery Test", test_parallel_recovery},
+        {"Cache Daemon Test", test_cache_daemon},
+        {"Shared Memory Cache Test", test_shm_cache_shared},
+        {"Shared Memory Recovery Test", test_shm_cache_recovery},
+        {"Sequential Prefetch Test", test_sequential_prefetch},
+        {"Bulk Ingest Test", test_bulk_ingest},
+        {"Message Parser Test", test_message_parser},
+        {"Hit Ratio Curve Test", test_hit_ratio_curve},
+        {"Cache Auto-Sizing Test", test_cache_autosize},
+        {"Near Cache Test", test_near_cache},
+        {"Time Source Test", test_time_source},
+        {"Delivery Bitmap Test", test_delivery_bitmap},
+        {"Background Eviction Test", test_background_eviction},
         {NULL, NULL}  // Sentinel to mark the end of the array
     };
 
+    remove(TEST_STORE_FILE);
+    remove(TEST_STORE_FILE TIME_INDEX_SUFFIX);
+    remove(TEST_STORE_FILE STORE_HINT_SUFFIX);
+    remove(TEST_STORE_FILE STORE_LOCK_SUFFIX);
+    remove(TEST_STORE_FILE DELIVERY_SUFFIX);
+    if (store_open(TEST_STORE_FILE) != 0) {
+        printf("Failed to open test message store.\n");
+        return EXIT_FAILURE;
+    }
+
     for (int i = 0; tests[i].function != NULL; i++) {
         run_test(tests[i]);
     }
 
+    store_close();
+    remove(TEST_STORE_FILE);
+    remove(TEST_STORE_FILE TIME_INDEX_SUFFIX);
+    remove(TEST_STORE_FILE STORE_HINT_SUFFIX);
+    remove(TEST_STORE_FILE STORE_LOCK_SUFFIX);
+    remove(TEST_STORE_FILE DELIVERY_SUFFIX);
+
     printf("All tests passed successfully.\n");
     return 0;
 }
@@ -102,14 +173,7 @@ void test_cache_hit() {
     assert_true(retrieved != NULL, "Failed to retrieve message from cache");
     assert_true(retrieved->hit_status == 1, "Cache hit failed");
     // Clean up
-    if (msg) {
-        free(msg);
-
-    }
-    if (retrieved && retrieved->hit_status != 3) {  // Do not free if not found
-        free(retrieved);
-
-    }
+    free(retrieved);
 }
 
 
@@ -123,9 +187,9 @@ void test_cache_miss_disk_search() {
     int test_id = 100; // Unique identifier for the test message
 
     // Manually create a file with the test message (simulate disk storage)
-    FILE *file = fopen("messages.txt", "a"); // Open file in append mode
+    FILE *file = fopen(TEST_STORE_FILE, "a"); // Open file in append mode
     if (file) {
-        fprintf(file, "%d %ld Alice Bob 'Message on disk' 1\n", test_id, (long)time(NULL));
+        fprintf(file, "%d %ld Alice Bob Message_on_disk 1\n", test_id, (long)time(NULL));
         fclose(file);
     } else {
         printf("Failed to open file for writing test message.\n");
@@ -138,9 +202,8 @@ void test_cache_miss_disk_search() {
     assert_true(retrieved->hit_status == 2, "Cache miss disk search failed"); // 2 indicates found on disk
 
     // Clean up
-    if (retrieved && retrieved->hit_status != 3) {  // Do not free if not found
-        free(retrieved);
-    }
+    free(retrieved);
+    delete_msg(test_id, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count);
 }
 
 void test_cache_miss_not_found() {
@@ -181,7 +244,7 @@ void test_lru_eviction() {
 
     // Access one of the messages to change its position in the LRU order
     int accessed_id = 2;  // Example: Accessing the message with ID 2
-    retrieve_msg(accessed_id, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    free(retrieve_msg(accessed_id, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU));
 
     // Add another message to trigger LRU eviction
     t_message* new_msg = create_msg(CACHE_SIZE, "Sender", "Receiver", "New Content", 1, MESSAGE_SIZE);
@@ -195,9 +258,7 @@ void test_lru_eviction() {
     assert_true(evicted_status->hit_status == 2 || evicted_status->hit_status == 3, "LRU eviction failed");
 
     // Clean up
-    if (evicted_status->hit_status != 3) {  // Do not free if not found
-        free(evicted_status);
-    }
+    free(evicted_status);
 }
 
 
@@ -229,3 +290,923 @@ void test_random_eviction() {
     // but this is complicated by the randomness of the eviction policy.
 }
 
+
+void test_posting_list_encoding() {
+    t_posting_list list;
+    posting_list_init(&list);
+
+    // Ascending ids are appended, out of order ids are inserted, duplicates are ignored
+    int input[] = {3, 200, 70000, 5, 3, 1};
+    for (int i = 0; i < 6; i++) {
+        posting_list_add(&list, input[i]);
+    }
+    assert_true(list.count == 5, "Posting list should hold 5 unique ids");
+
+    int ids[5];
+    int expected[] = {1, 3, 5, 200, 70000};
+    assert_true(posting_list_decode(&list, ids) == 5, "Posting list decoded the wrong number of ids");
+    for (int i = 0; i < 5; i++) {
+        assert_true(ids[i] == expected[i], "Posting list is not sorted");
+    }
+
+    assert_true(posting_list_remove(&list, 200) == 1, "Failed to remove id from posting list");
+    assert_true(posting_list_remove(&list, 200) == 0, "Removed id should no longer be present");
+    assert_true(list.count == 4, "Posting list should hold 4 ids after removal");
+
+    // Removing the last id must leave the list appendable after the new last id
+    assert_true(posting_list_remove(&list, 70000) == 1 && list.last_id == 5, "Removing the last id should move last_id back");
+    posting_list_add(&list, 300);
+    posting_list_add(&list, 4);
+    int after[] = {1, 3, 4, 5, 300};
+    assert_true(posting_list_decode(&list, ids) == 5, "Posting list decoded the wrong number of ids after edits");
+    for (int i = 0; i < 5; i++) {
+        assert_true(ids[i] == after[i], "Posting list edits broke the order");
+    }
+
+    // A sorted batch is merged in one pass, skipping ids already present
+    int batch[] = {0, 2, 4, 300, 301};
+    assert_true(posting_list_merge(&list, batch, 5) == 3, "Merge should add only the new ids");
+    int merged[8];
+    int expected_merged[] = {0, 1, 2, 3, 4, 5, 300, 301};
+    assert_true(posting_list_decode(&list, merged) == 8 && list.last_id == 301, "Merged list has the wrong ids");
+    for (int i = 0; i < 8; i++) {
+        assert_true(merged[i] == expected_merged[i], "Merged list is not sorted");
+    }
+
+    posting_list_free(&list);
+}
+
+
+// Visitor used to count the messages streamed by a query
+static void count_visited(const t_message_status* status, void* arg) {
+    (*(int*)arg)++;
+}
+
+
+void test_secondary_index_query() {
+    // Initialize cache
+    memset(cache_hash_table, 0, sizeof(cache_hash_table));
+    lru_cache.head = NULL;
+    lru_cache.tail = NULL;
+    cache_count = 0;
+    msg_index_reset();
+
+    // Index a small inbox: ids 5000..5009, alternating senders, every third message delivered
+    for (int i = 0; i < 10; i++) {
+        t_message* msg = create_msg(5000 + i, (i % 2) ? "IdxCarol" : "IdxDave", "IdxErin", "Inbox", (i % 3 == 0), MESSAGE_SIZE);
+        assert_true(msg != NULL, "Failed to create a message");
+        store_msg(msg, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+        free(msg);
+    }
+
+    int* ids;
+    t_msg_query undelivered_for_erin = { .sender = NULL, .receiver = "IdxErin", .delivered = 0 };
+    int n = msg_index_query(&undelivered_for_erin, &ids);
+    assert_true(n == 6, "Expected 6 undelivered messages for receiver");
+    for (int i = 0; i < n; i++) {
+        assert_true((ids[i] - 5000) % 3 != 0, "Delivered message returned by undelivered query");
+        assert_true(i == 0 || ids[i] > ids[i - 1], "Query result is not in id order");
+    }
+    free(ids);
+
+    t_msg_query from_carol = { .sender = "IdxCarol", .receiver = "IdxErin", .delivered = 0 };
+    n = msg_index_query(&from_carol, &ids);
+    assert_true(n == 3, "Expected 3 undelivered messages from sender to receiver");  // 5001, 5005, 5007
+    assert_true(ids[0] == 5001 && ids[1] == 5005 && ids[2] == 5007, "Intersection returned wrong ids");
+    free(ids);
+
+    t_msg_query unknown = { .sender = "IdxNobody", .receiver = NULL, .delivered = -1 };
+    assert_true(msg_index_query(&unknown, &ids) == 0 && ids == NULL, "Unknown sender should match nothing");
+
+    int streamed = 0;
+    msg_index_stream(&from_carol, count_visited, &streamed, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    assert_true(streamed == 3, "Streaming the query did not visit every match");
+}
+
+
+// Visitor used to collect the ids streamed by a time range scan
+static void collect_ids(const t_message* msg, long offset, void* arg) {
+    int* ids = (int*)arg;
+    ids[++ids[0]] = msg->identifier;
+}
+
+
+void test_time_range_scan() {
+    const char* store = "test_time_index.txt";
+    remove(store);
+    remove("test_time_index.txt" TIME_INDEX_SUFFIX);
+
+    // 200 records, 10ms apart, spanning several index blocks
+    FILE* file = fopen(store, "w");
+    assert_true(file != NULL, "Failed to create time index test store");
+    for (int i = 0; i < 200; i++) {
+        fprintf(file, "%d %ld Sender Receiver Content 0\n", i, 1000L + i * 10);
+    }
+    fclose(file);
+
+    assert_true(time_index_open(store) == 0, "Failed to build the time index");
+    int ids[64] = {0};
+    assert_true(time_index_scan(1500, 1595, collect_ids, ids) == 10, "Expected 10 messages in time range");
+    for (int i = 1; i <= 10; i++) {
+        assert_true(ids[i] == 49 + i, "Time range scan returned the wrong messages");
+    }
+    time_index_close();
+
+    // Records appended after the index was written are picked up when it is reopened
+    file = fopen(store, "a");
+    fprintf(file, "200 5000 Sender Receiver Late 0\n");
+    fclose(file);
+    assert_true(time_index_open(store) == 0, "Failed to reopen the time index");
+    memset(ids, 0, sizeof(ids));
+    assert_true(time_index_scan(4000, 6000, collect_ids, ids) == 1 && ids[1] == 200, "Appended record missing from time index");
+
+    // An out of order timestamp disables the early exit but is still found
+    file = fopen(store, "a");
+    fprintf(file, "201 1501 Sender Receiver Backdated 0\n");
+    fclose(file);
+    memset(ids, 0, sizeof(ids));
+    assert_true(time_index_scan(1500, 1510, collect_ids, ids) == 3, "Out of order record missing from time range");
+    assert_true(ids[1] == 50 && ids[2] == 51 && ids[3] == 201, "Time range scan is not in file order");
+    time_index_close();
+
+    // A file replaced by a longer one no longer matches the tail checksum, so the index is rebuilt
+    file = fopen(store, "w");
+    for (int i = 0; i < 210; i++) {
+        fprintf(file, "%d %ld Sender Receiver Replaced 0\n", i, 9000L + i * 10);
+    }
+    fclose(file);
+    assert_true(time_index_open(store) == 0, "Failed to reopen the time index");
+    memset(ids, 0, sizeof(ids));
+    assert_true(time_index_scan(9000, 9100, collect_ids, ids) == 11, "Stale time index used for a replaced file");
+
+    time_index_close();
+    remove(store);
+    remove("test_time_index.txt" TIME_INDEX_SUFFIX);
+}
+
+
+void test_update_and_delete() {
+    // Initialize cache
+    memset(cache_hash_table, 0, sizeof(cache_hash_table));
+    lru_cache.head = NULL;
+    lru_cache.tail = NULL;
+    cache_count = 0;
+
+    t_message* msg = create_msg(6000, "Sender", "Receiver", "Pending", 0, MESSAGE_SIZE);
+    assert_true(msg != NULL, "Failed to create a message");
+    store_msg(msg, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+
+    // Mark it delivered: the store and the cached copy both see the new version
+    msg->delivered = 1;
+    assert_true(update_msg(msg, cache_hash_table, HASH_TABLE_SIZE, &lru_cache) == 0, "Failed to update message");
+    t_message on_disk;
+    assert_true(store_get(6000, &on_disk) == 1 && on_disk.delivered == 1, "Store still holds the old version");
+    t_message_status* cached = retrieve_msg(6000, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    assert_true(cached->hit_status == 1 && cached->message.delivered == 1, "Cache still holds the old version");
+    free(cached);
+
+    t_store_stats stats;
+    store_get_stats(&stats);
+    assert_true(stats.garbage_bytes > 0, "Superseded record not counted as garbage");
+
+    // Delete it: gone from the cache, the store, and the secondary index
+    assert_true(delete_msg(6000, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count) == 0, "Failed to delete message");
+    assert_true(cache_count == 0, "Deleted message still counted in cache");
+    assert_true(store_contains(6000) == 0, "Deleted message still in store");
+    t_message_status* gone = retrieve_msg(6000, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    assert_true(gone->hit_status == 3, "Deleted message was found");
+    free(gone);
+    assert_true(delete_msg(6000, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count) == -1, "Deleting twice should fail");
+
+    // The tombstone survives reopening the store
+    store_close();
+    assert_true(store_open(TEST_STORE_FILE) == 0, "Failed to reopen store");
+    assert_true(store_contains(6000) == 0, "Deleted message came back after reopening");
+    free(msg);
+}
+
+
+void test_background_compaction() {
+    // 100 messages, each updated twice, so two thirds of the log is garbage
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < 100; i++) {
+            t_message* msg = create_msg(7000 + i, "Sender", "Receiver", round ? "Updated" : "Original", round == 2, MESSAGE_SIZE);
+            assert_true(msg != NULL, "Failed to create a message");
+            msg->time_sent = 100000 + i;
+            if (round == 0) {
+                assert_true(store_insert(msg) == 1, "Failed to insert message");
+            } else {
+                assert_true(store_update(msg) == 0, "Failed to update message");
+            }
+            free(msg);
+        }
+    }
+    for (int i = 50; i < 100; i++) {
+        store_delete(7000 + i);
+    }
+
+    t_store_stats before;
+    store_get_stats(&before);
+    assert_true(store_start_compactor(0.5, 1) == 0, "Failed to start compactor");
+
+    t_store_stats after;
+    for (int waited = 0; waited < 200; waited++) {
+        store_get_stats(&after);
+        if (after.compactions > before.compactions) break;
+        usleep(10000);
+    }
+    store_stop_compactor();
+    assert_true(after.compactions > before.compactions, "Compactor never ran");
+    assert_true(after.garbage_bytes == 0 && after.file_bytes == after.live_bytes, "Compacted store still holds garbage");
+    assert_true(after.file_bytes < before.file_bytes, "Compaction did not shrink the store");
+
+    t_message msg;
+    assert_true(store_get(7010, &msg) == 1 && msg.delivered == 1 && strcmp(msg.content, "Updated") == 0, "Compaction lost the latest version");
+    assert_true(store_get(7060, &msg) == 0, "Compaction resurrected a deleted message");
+
+    // Only live versions show up in time range scans, and the compacted file is back in time order
+    int ids[128] = {0};
+    assert_true(store_scan_time(100000, 100099, collect_ids, ids) == 50, "Time range scan returned dead records");
+    for (int i = 1; i <= 50; i++) {
+        assert_true(ids[i] == 6999 + i, "Compacted file is not in time order");
+    }
+
+    // Another process updates and compacts the same store; this one follows it to the new file
+    fflush(stdout);
+    pid_t pid = fork();
+    assert_true(pid >= 0, "Failed to fork compacting process");
+    if (pid == 0) {
+        store_close(); // own descriptors, not the ones shared with the parent
+        if (store_open(TEST_STORE_FILE) != 0) _exit(1);
+        t_message* moved = create_msg(7010, "Sender", "Receiver", "Moved", 1, MESSAGE_SIZE);
+        int rc = store_update(moved) == 0 && store_compact() == 0 ? 0 : 1;
+        free(moved);
+        store_close();
+        _exit(rc);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    assert_true(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0, "Compacting process failed");
+    t_message* later = create_msg(7200, "Sender", "Receiver", "After", 0, MESSAGE_SIZE);
+    assert_true(store_insert(later) == 1, "Failed to insert after another process compacted");
+    free(later);
+    assert_true(store_get(7010, &msg) == 1 && strcmp(msg.content, "Moved") == 0, "Store kept reading the file replaced by compaction");
+    assert_true(store_get(7200, &msg) == 1 && store_get(7011, &msg) == 1, "Insert after compaction landed in the old file");
+    struct stat st;
+    t_store_stats followed;
+    store_get_stats(&followed);
+    assert_true(stat(TEST_STORE_FILE, &st) == 0 && st.st_size == followed.file_bytes, "Store and file disagree on the size after compaction");
+}
+
+
+void test_parallel_recovery() {
+    const char* store = "test_recovery.txt";
+    store_close();
+    remove(store);
+    remove("test_recovery.txt" STORE_HINT_SUFFIX);
+    assert_true(store_open(store) == 0, "Failed to open recovery test store");
+
+    // Enough records for several chunks, with updates and deletes crossing chunk boundaries
+    for (int i = 0; i < 3000; i++) {
+        t_message* msg = create_msg(i, "Sender", "Receiver", "Payload", 0, MESSAGE_SIZE);
+        store_insert(msg);
+        free(msg);
+    }
+    for (int i = 0; i < 3000; i += 10) {
+        t_message* msg = create_msg(i, "Sender", "Receiver", "Payload", 1, MESSAGE_SIZE);
+        store_update(msg);
+        free(msg);
+    }
+    for (int i = 0; i < 3000; i += 7) {
+        store_delete(i);
+    }
+    t_store_stats expected;
+    store_get_stats(&expected);
+
+    // Without the hint, the keydir is rebuilt from the log by 4 threads
+    store_close();
+    remove("test_recovery.txt" STORE_HINT_SUFFIX);
+    store_set_recovery_threads(4);
+    assert_true(store_open(store) == 0, "Failed to recover store");
+    t_store_stats recovered;
+    store_get_stats(&recovered);
+    assert_true(recovered.live_records == expected.live_records, "Recovered keydir has the wrong number of records");
+    assert_true(recovered.live_bytes == expected.live_bytes && recovered.garbage_bytes == expected.garbage_bytes, "Recovered keydir has the wrong byte counts");
+
+    t_message msg;
+    assert_true(store_get(10, &msg) == 1 && msg.delivered == 1, "Recovery lost an update");
+    assert_true(store_get(14, &msg) == 0, "Recovery resurrected a deleted message");
+    assert_true(store_get(2999, &msg) == 1 && msg.identifier == 2999, "Recovery lost the last record");
+
+    // Torn writes at the tail are cut off rather than parsed as messages
+    store_close();
+    FILE* file = fopen(store, "a");
+    const char* torn = "5000 1 Sender Receiver Torn 0 ~00000000\n6000 1 Sen";
+    fputs(torn, file);
+    fclose(file);
+    assert_true(store_open(store) == 0, "Failed to reopen store with torn tail");
+    store_get_stats(&recovered);
+    assert_true(recovered.truncated_bytes == (long)strlen(torn), "Torn tail was not truncated");
+    assert_true(recovered.file_bytes == expected.file_bytes, "Truncation cut into intact records");
+    assert_true(store_contains(5000) == 0 && store_contains(6000) == 0, "Torn record was parsed as a message");
+
+    store_close();
+    store_set_recovery_threads(0);
+    remove(store);
+    remove("test_recovery.txt" STORE_HINT_SUFFIX);
+    remove("test_recovery.txt" STORE_LOCK_SUFFIX);
+    assert_true(store_open(TEST_STORE_FILE) == 0, "Failed to reopen test store");
+}
+
+
+void test_cache_daemon() {
+    const char* socket_path = "test_cache.sock";
+    fflush(stdout);
+    pid_t pid = fork();
+    assert_true(pid >= 0, "Failed to fork cache daemon");
+    if (pid == 0) {
+        // The daemon's own logging would interleave with the test output
+        freopen("/dev/null", "w", stdout);
+        _exit(cache_server_run(socket_path, LRU) == 0 ? 0 : 1);
+    }
+
+    t_cache_client* client = NULL;
+    for (int attempt = 0; attempt < 200 && !client; attempt++) {
+        client = client_connect(socket_path);
+        if (!client) usleep(10000);
+    }
+    assert_true(client != NULL, "Failed to connect to cache daemon");
+
+    // Pipeline more puts than the daemon's cache holds
+    t_message msgs[CACHE_SIZE + 4];
+    for (int i = 0; i < CACHE_SIZE + 4; i++) {
+        t_message* msg = create_msg(8000 + i, "Sender", "Receiver", "Daemon", 0, MESSAGE_SIZE);
+        msgs[i] = *msg;
+        free(msg);
+    }
+    assert_true(client_store_msgs(client, msgs, CACHE_SIZE + 4) == 0, "Pipelined stores failed");
+
+    t_message_status* status = client_retrieve_msg(client, 8000 + CACHE_SIZE + 3);
+    assert_true(status != NULL && status->hit_status == 1, "Latest message should be in the daemon's cache");
+    assert_true(strcmp(status->message.content, "Daemon") == 0 && status->message.time_sent == msgs[CACHE_SIZE + 3].time_sent, "Message was not sent intact");
+    free(status);
+
+    int ids[] = {8000, 8000 + CACHE_SIZE + 2, 99999};
+    t_message_status statuses[3];
+    assert_true(client_retrieve_msgs(client, ids, 3, statuses) == 0, "Multi-get failed");
+    assert_true(statuses[0].hit_status == 2, "Evicted message should come from disk");
+    assert_true(statuses[1].hit_status == 1, "Recent message should come from cache");
+    assert_true(statuses[2].hit_status == 3, "Unknown message should not be found");
+
+    // Negative ids and messages the store could not read back are refused, and the daemon keeps serving
+    t_message bad = msgs[0];
+    bad.identifier = -4;
+    assert_true(client_store_msg(client, &bad) == -1, "Put with a negative id should be refused");
+    bad = msgs[0];
+    strcpy(bad.content, "two words");
+    assert_true(client_store_msg(client, &bad) == -1, "Put with whitespace in a field should be refused");
+    assert_true(client_retrieve_msg(client, -1) == NULL, "Get with a negative id should be refused");
+    int bad_ids[] = {8000, -2};
+    assert_true(client_retrieve_msgs(client, bad_ids, 2, statuses) == -1, "Multi-get with a negative id should be refused");
+
+    // Refused requests leave the connection usable
+    status = client_retrieve_msg(client, 8000 + CACHE_SIZE + 3);
+    assert_true(status != NULL && status->message.identifier == 8000 + CACHE_SIZE + 3, "Get after refused requests returned the wrong response");
+    free(status);
+
+    // A second client shares the same cache
+    t_cache_client* other = client_connect(socket_path);
+    assert_true(other != NULL, "Failed to open second connection");
+    status = client_retrieve_msg(other, 8000);
+    assert_true(status != NULL && status->hit_status == 1, "Second client should hit the shared cache");
+    free(status);
+
+    client_close(other);
+    client_close(client);
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    unlink(socket_path);
+}
+
+
+#define TEST_SHM_NAME "/p1_test_message_cache"
+
+void test_shm_cache_shared() {
+    shm_cache_unlink(TEST_SHM_NAME);
+    t_shm_cache* cache = shm_cache_open(TEST_SHM_NAME, 4);
+    assert_true(cache != NULL, "Failed to create shared cache");
+
+    // Another process fills the cache past its capacity
+    fflush(stdout);
+    pid_t pid = fork();
+    assert_true(pid >= 0, "Failed to fork writer");
+    if (pid == 0) {
+        t_shm_cache* writer = shm_cache_open(TEST_SHM_NAME, 4);
+        if (!writer) _exit(1);
+        for (int i = 0; i < 6; i++) {
+            t_message* msg = create_msg(9000 + i, "Sender", "Receiver", "Shared", 0, MESSAGE_SIZE);
+            shm_cache_put(writer, msg);
+            free(msg);
+        }
+        shm_cache_close(writer);
+        _exit(0);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    assert_true(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0, "Writer process failed");
+
+    t_message msg;
+    assert_true(shm_cache_get(cache, 9005, &msg) == 1 && strcmp(msg.content, "Shared") == 0, "Message put by another process should be cached");
+    assert_true(shm_cache_get(cache, 9000, &msg) == 0, "Least recently used message should have been evicted");
+    assert_true(shm_cache_get(cache, 9002, &msg) == 1, "Message within capacity should be cached");
+
+    t_shm_cache_stats stats;
+    shm_cache_get_stats(cache, &stats);
+    assert_true(stats.count == 4 && stats.hits == 2 && stats.misses == 1, "Unexpected shared cache counters");
+
+    assert_true(shm_cache_remove(cache, 9002) == 1 && shm_cache_get(cache, 9002, &msg) == 0, "Removed message should be gone");
+    shm_cache_close(cache);
+    shm_cache_unlink(TEST_SHM_NAME);
+}
+
+void test_shm_cache_recovery() {
+    shm_cache_unlink(TEST_SHM_NAME);
+    t_shm_cache* cache = shm_cache_open(TEST_SHM_NAME, 4);
+    assert_true(cache != NULL, "Failed to create shared cache");
+    for (int i = 0; i < 4; i++) {
+        t_message* msg = create_msg(9100 + i, "Sender", "Receiver", "Shared", 0, MESSAGE_SIZE);
+        shm_cache_put(cache, msg);
+        free(msg);
+    }
+
+    // A process dies holding the lock, halfway through rewriting a slot and its links
+    fflush(stdout);
+    pid_t pid = fork();
+    assert_true(pid >= 0, "Failed to fork writer");
+    if (pid == 0) {
+        t_shm_cache* writer = shm_cache_open(TEST_SHM_NAME, 4);
+        if (!writer || pthread_mutex_lock(&writer->header->lock) != 0) _exit(1);
+        int32_t index = writer->header->lru_head;
+        writer->slots[index].state = SHM_SLOT_WRITING;
+        writer->header->lru_head = SHM_NIL;
+        _exit(0);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    assert_true(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0, "Writer process failed");
+
+    t_message msg;
+    assert_true(shm_cache_get(cache, 9103, &msg) == 0, "Half-written message should be dropped");
+    assert_true(shm_cache_get(cache, 9100, &msg) == 1, "Intact messages should survive the repair");
+
+    t_shm_cache_stats stats;
+    shm_cache_get_stats(cache, &stats);
+    assert_true(stats.recoveries == 1 && stats.count == 3, "Shared cache was not repaired");
+
+    // The recency order was rebuilt too: 9101 is now the least recently used
+    for (int i = 4; i < 6; i++) {
+        t_message* extra = create_msg(9100 + i, "Sender", "Receiver", "Shared", 0, MESSAGE_SIZE);
+        shm_cache_put(cache, extra);
+        free(extra);
+    }
+    assert_true(shm_cache_get(cache, 9101, &msg) == 0, "Least recently used message should have been evicted");
+    assert_true(shm_cache_get(cache, 9102, &msg) == 1, "Message within capacity should be cached");
+    shm_cache_close(cache);
+    shm_cache_unlink(TEST_SHM_NAME);
+}
+
+
+static int cached_in_table(int identifier) {
+    for (t_cache_hash_entry* entry = cache_hash_table[identifier % HASH_TABLE_SIZE]; entry; entry = entry->next) {
+        if (entry->key == identifier) return 1;
+    }
+    return 0;
+}
+
+void test_sequential_prefetch() {
+    // Initialize cache
+    memset(cache_hash_table, 0, sizeof(cache_hash_table));
+    lru_cache.head = NULL;
+    lru_cache.tail = NULL;
+    cache_count = 0;
+    prefetch_reset();
+
+    for (int i = 0; i < 64; i++) {
+        t_message* msg = create_msg(11000 + i, "Sender", "Receiver", "Sequential", 0, MESSAGE_SIZE);
+        assert_true(store_insert(msg) == 1, "Failed to store message");
+        free(msg);
+    }
+
+    // Three misses in a row establish the stream; the rest are read ahead
+    for (int i = 0; i < 40; i++) {
+        t_message_status* status = retrieve_msg(11000 + i, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+        assert_true(status->hit_status == 2 && status->message.identifier == 11000 + i, "Wrong message retrieved");
+        free(status);
+    }
+
+    t_prefetch_stats stats;
+    prefetch_get_stats(&stats);
+    assert_true(stats.used == 37 && stats.wasted == 0, "Sequential misses were not prefetched");
+    assert_true(stats.max_depth > PREFETCH_INITIAL_DEPTH, "Read-ahead window did not grow");
+    assert_true(stats.issued > stats.used, "Nothing read ahead of the last request");
+
+    // Read-ahead waits in the prefetch buffer, not in the cache
+    assert_true(!cached_in_table(11040), "Prefetched message should not be cached before it is requested");
+    t_message_status* status = retrieve_msg(11040, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    assert_true(status->hit_status == 2 && cached_in_table(11040), "Prefetched message should be cached once requested");
+    free(status);
+
+    // Changed messages are not served from a stale read-ahead
+    t_message* msg = create_msg(11041, "Sender", "Receiver", "Changed", 0, MESSAGE_SIZE);
+    assert_true(update_msg(msg, cache_hash_table, HASH_TABLE_SIZE, &lru_cache) == 0, "Failed to update message");
+    free(msg);
+    status = retrieve_msg(11041, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    assert_true(strcmp(status->message.content, "Changed") == 0, "Stale prefetched copy was returned");
+    free(status);
+
+    // A stream running into INT_MAX reads ahead up to it instead of overflowing
+    prefetch_reset();
+    for (int id = INT_MAX - 3; id < INT_MAX; id++) {
+        prefetch_on_miss(id);
+    }
+    prefetch_get_stats(&stats);
+    assert_true(stats.triggers == 1, "Read-ahead near INT_MAX was not clamped");
+}
+
+
+void test_bulk_ingest() {
+    // Initialize cache
+    memset(cache_hash_table, 0, sizeof(cache_hash_table));
+    lru_cache.head = NULL;
+    lru_cache.tail = NULL;
+    cache_count = 0;
+
+    // A file spanning several batches, with repeats and lines that do not parse
+    FILE* in = tmpfile();
+    assert_true(in != NULL, "Failed to create input file");
+    for (int i = 0; i < 10000; i++) {
+        fprintf(in, "%d %d Sender%d Receiver%d Bulk%d %d\n", 20000 + i, 1000 + i, i % 7, i % 5, i, i % 2);
+    }
+    fprintf(in, "20000 1 Sender Receiver Repeated 0\n\nnot a message\nD 20001 1\n");
+    rewind(in);
+    t_ingest_stats stats;
+    assert_true(ingest_file(in, &stats) == 0, "Bulk load failed");
+    fclose(in);
+    assert_true(stats.received == 10003 && stats.stored == 10000, "Not every message was loaded");
+    assert_true(stats.duplicates == 1 && stats.rejected == 2, "Unexpected duplicate or rejected counts");
+
+    t_message msg;
+    assert_true(store_get(20000, &msg) == 1 && strcmp(msg.content, "Bulk0") == 0, "First occurrence of an id should win");
+    assert_true(store_get(29999, &msg) == 1 && msg.time_sent == 10999 && msg.delivered == 1, "Last message was not loaded intact");
+
+    // Through the API, priming the cache with what was loaded last
+    t_ingest* ingest = ingest_begin();
+    assert_true(ingest != NULL, "Failed to start bulk load");
+    ingest_prime_cache(ingest, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    for (int i = 0; i < CACHE_SIZE + 4; i++) {
+        t_message* bulk = create_msg(30000 + i, "Sender", "Receiver", "Primed", 0, MESSAGE_SIZE);
+        assert_true(ingest_add(ingest, bulk) == 0, "Valid message was rejected");
+        free(bulk);
+    }
+    t_message* invalid = create_msg(30100, "Sender", "Receiver", "Two words", 0, MESSAGE_SIZE);
+    assert_true(ingest_add(ingest, invalid) == 1, "Content that cannot be read back should be rejected");
+    free(invalid);
+    assert_true(ingest_end(ingest, &stats) == 0 && stats.stored == CACHE_SIZE + 4 && stats.rejected == 1, "Bulk load through the API failed");
+
+    assert_true(cache_count == CACHE_SIZE, "Cache should be primed up to its size");
+    t_message_status* status = retrieve_msg(30000 + CACHE_SIZE + 3, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    assert_true(status->hit_status == 1, "Last loaded message should be cached");
+    free(status);
+    assert_true(lru_cache.tail->key == 30004, "Oldest primed message should be least recently used");
+}
+
+
+void test_message_parser() {
+    char long_content[1200];
+    memset(long_content, 'x', sizeof(long_content));
+    char long_line[1300];
+    long_content[SCAN_MAX_CONTENT] = '\0';
+    snprintf(long_line, sizeof(long_line), "7 70 Sender Receiver %s 1\n", long_content);
+    char too_long_line[1300];
+    long_content[SCAN_MAX_CONTENT] = 'x';
+    long_content[SCAN_MAX_CONTENT + 1] = '\0';
+    snprintf(too_long_line, sizeof(too_long_line), "7 70 Sender Receiver %s 1\n", long_content);
+
+    // The hand-written parser must agree with the sscanf one it replaced
+    const char* lines[] = {
+        "1 1700000000000 Alice Bob Hello 0\n",
+        "2 1700000000001 Alice Bob Sealed_record_with_a_longer_body 1 ~0badf00d\n",
+        "  3   17\tAlice  Bob  Spaced 0\n",
+        "-4 -5 A B C 1",
+        "5 6 Alice Bob\n",
+        "six 6 Alice Bob Hello 0\n",
+        "7x 7 Alice Bob Hello 0\n",
+        "8 8 Alice Bob Hello\n",
+        "",
+        long_line,
+        too_long_line,
+    };
+    for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        t_message expected, actual;
+        int ok_expected = parse_msg_line_scanf(lines[i], &expected);
+        int ok_actual = scan_msg_line(lines[i], lines[i] + strlen(lines[i]), &actual);
+        assert_true(ok_expected == ok_actual, "Parsers disagree on whether a line is a message");
+        if (!ok_expected) continue;
+        assert_true(expected.identifier == actual.identifier && expected.time_sent == actual.time_sent && expected.delivered == actual.delivered, "Parsers disagree on a number");
+        assert_true(strcmp(expected.sender, actual.sender) == 0 && strcmp(expected.receiver, actual.receiver) == 0 && strcmp(expected.content, actual.content) == 0, "Parsers disagree on a field");
+    }
+
+    // The fast paths read only what they need
+    const char* line = "42 1234 Alice Bob Hello 1 ~00000000\n";
+    const char* end = line + strlen(line);
+    int id;
+    long time_sent;
+    assert_true(scan_msg_id(line, end, &id) == 1 && id == 42, "Leading id not read");
+    assert_true(scan_msg_header(line, end, &id, &time_sent) == 1 && time_sent == 1234, "Header not read");
+    assert_true(scan_msg_header(line, line + 20, &id, &time_sent) == 0, "Truncated line accepted");
+    assert_true(scan_find_newline(line, end) == end - 1, "Newline not found");
+    assert_true(scan_field_end(long_line + 21, long_line + strlen(long_line)) == long_line + 21 + SCAN_MAX_CONTENT, "Field end not found");
+
+    // The widest content a message holds reads back from the store
+    long_content[SCAN_MAX_CONTENT] = '\0';
+    t_message* widest = create_msg(31500, "Sender", "Receiver", long_content, 0, CONTEXT_SIZE);
+    assert_true(widest != NULL && strlen(widest->content) == CONTEXT_SIZE - 1, "Failed to create the widest message");
+    t_message read_back;
+    assert_true(store_insert(widest) == 1, "Failed to store the widest message");
+    assert_true(store_get(31500, &read_back) == 1 && strcmp(read_back.content, widest->content) == 0, "Widest message did not read back");
+    free(widest);
+}
+
+
+#define TEST_ENTRY_BYTES ((int)(sizeof(t_cache_hash_entry) + sizeof(t_lru_node)))
+
+void test_hit_ratio_curve() {
+    t_sizer_config config = { .memory_ceiling = 64L * TEST_ENTRY_BYTES, .sample_rate = 1.0, .interval = 1 << 20 };
+    assert_true(sizer_init(&config, TEST_ENTRY_BYTES) == 0, "Failed to start the sizer");
+    assert_true(sizer_max_capacity() == 64, "Memory ceiling not turned into a capacity");
+
+    // Cycling through 24 ids: LRU misses every time below 24 entries, hits every time from 24
+    for (int round = 0; round < 10; round++) {
+        for (int id = 0; id < 24; id++) sizer_record(id);
+    }
+    assert_true(sizer_hit_ratio(23) == 0, "Smaller cache should never hit");
+    assert_true(sizer_hit_ratio(24) == 0.9 && sizer_hit_ratio(64) == 0.9, "Cache of the working set should hit all but the first pass");
+
+    t_sizer_point points[16];
+    assert_true(sizer_get_curve(points, 16) == 16 && points[15].capacity == 128, "Curve should reach past the ceiling");
+    assert_true(points[1].hit_ratio == 0 && points[2].hit_ratio == 0.9 && points[2].marginal > 0 && points[3].marginal == 0, "Memory past the working set should have no marginal value");
+
+    // A small stack renumbers its access times many times over; the distances must not change
+    t_sizer_config small = { .memory_ceiling = 8L * TEST_ENTRY_BYTES, .sample_rate = 1.0, .interval = 1 << 20 };
+    assert_true(sizer_init(&small, TEST_ENTRY_BYTES) == 0, "Failed to restart the sizer");
+    for (int round = 0; round < 20; round++) {
+        for (int id = 0; id < 12; id++) sizer_record(id);
+    }
+    assert_true(sizer_hit_ratio(11) == 0 && sizer_hit_ratio(12) == 0.95, "Stack distances changed when access times were renumbered");
+    sizer_free();
+}
+
+void test_cache_autosize() {
+    // Initialize cache
+    memset(cache_hash_table, 0, sizeof(cache_hash_table));
+    lru_cache.head = NULL;
+    lru_cache.tail = NULL;
+    cache_count = 0;
+    for (int i = 0; i < 24; i++) {
+        t_message* msg = create_msg(12000 + i, "Sender", "Receiver", "Sized", 0, MESSAGE_SIZE);
+        store_insert(msg);
+        free(msg);
+    }
+
+    t_sizer_config config = { .memory_ceiling = 64L * TEST_ENTRY_BYTES, .min_capacity = 4, .target_hit_ratio = 0.9, .sample_rate = 1.0, .interval = 64, .adjust = true };
+    assert_true(cache_enable_autosize(&config) == 0, "Failed to enable auto-sizing");
+
+    // A working set larger than the cache: it grows to fit the set, and no further
+    for (int i = 0; i < 256; i++) {
+        t_message_status* status = retrieve_msg(12000 + i % 24, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+        free(status);
+    }
+    assert_true(cache_get_capacity() == 24, "Cache should grow to the working set");
+    int hits = 0;
+    for (int i = 0; i < 24; i++) {
+        t_message_status* status = retrieve_msg(12000 + i, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+        if (status->hit_status == 1) hits++;
+        free(status);
+    }
+    assert_true(hits == 24, "Working set should now fit in the cache");
+
+    // The workload narrows to one message: the cache gives memory back
+    for (int i = 0; i < 640; i++) {
+        t_message_status* status = retrieve_msg(12000, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+        free(status);
+    }
+    assert_true(cache_get_capacity() == 4 && cache_count <= 4, "Cache should shrink to its minimum");
+
+    cache_disable_autosize();
+    cache_resize(CACHE_SIZE, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+}
+
+void test_near_cache() {
+    shm_cache_unlink(TEST_SHM_NAME);
+    t_shm_cache* cache = shm_cache_open(TEST_SHM_NAME, 2);
+    assert_true(cache != NULL, "Failed to create shared cache");
+    near_cache_enable(true);
+    near_cache_clear();
+
+    t_message* first = create_msg(9200, "Sender", "Receiver", "First", 0, MESSAGE_SIZE);
+    shm_cache_put(cache, first);
+    free(first);
+
+    // The first read copies the message into this thread, the second is served from the copy
+    t_message msg;
+    t_shm_cache_stats shared;
+    t_near_cache_stats near;
+    assert_true(near_cache_get(cache, 9200, &msg) == 1 && near_cache_get(cache, 9200, &msg) == 1, "Cached message should be found");
+    shm_cache_get_stats(cache, &shared);
+    near_cache_get_stats(&near);
+    assert_true(shared.hits == 1 && near.hits == 1 && near.misses == 1, "Second read should not reach the shared cache");
+
+    // An update from another process invalidates the copy without telling this one
+    fflush(stdout);
+    pid_t pid = fork();
+    assert_true(pid >= 0, "Failed to fork writer");
+    if (pid == 0) {
+        t_shm_cache* writer = shm_cache_open(TEST_SHM_NAME, 2);
+        if (!writer) _exit(1);
+        t_message* second = create_msg(9200, "Sender", "Receiver", "Second", 0, MESSAGE_SIZE);
+        shm_cache_put(writer, second);
+        free(second);
+        shm_cache_close(writer);
+        _exit(0);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    assert_true(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0, "Writer process failed");
+    assert_true(near_cache_get(cache, 9200, &msg) == 1 && strcmp(msg.content, "Second") == 0, "Updated message should be read again");
+
+    // So does an eviction
+    for (int i = 1; i <= 2; i++) {
+        t_message* other = create_msg(9200 + i, "Sender", "Receiver", "Other", 0, MESSAGE_SIZE);
+        shm_cache_put(cache, other);
+        free(other);
+    }
+    assert_true(near_cache_get(cache, 9200, &msg) == 0, "Evicted message should not be served from the copy");
+    near_cache_get_stats(&near);
+    assert_true(near.stale == 2, "Both invalidations should have been noticed");
+
+    near_cache_enable(false);
+    near_cache_clear();
+    shm_cache_close(cache);
+    shm_cache_unlink(TEST_SHM_NAME);
+}
+
+void test_time_source() {
+    // Virtual time only moves when told to
+    timesource_use_virtual(5000, 0);
+    t_message* msg = create_msg(13000, "Sender", "Receiver", "Virtual", 0, MESSAGE_SIZE);
+    assert_true(msg->time_sent == 5000 && current_timestamp_ms() == 5000, "Virtual time should stand still");
+    free(msg);
+    timesource_advance(250);
+    assert_true(current_timestamp_ms() == 5250, "Virtual time should move by the amount advanced");
+
+    // With a step, every read is distinct and the sequence is reproducible
+    timesource_use_virtual(0, 1);
+    long long first = current_timestamp_ms();
+    long long second = current_timestamp_ms();
+    assert_true(first == 0 && second == 1, "Each read should move virtual time by the step");
+
+    // The coarse clock follows the system clock at tick granularity
+    assert_true(timesource_use_coarse(1) == 0 && timesource_get_kind() == TIMESOURCE_COARSE, "Failed to start the coarse clock");
+    struct timespec spec;
+    clock_gettime(CLOCK_REALTIME, &spec);
+    long long real = spec.tv_sec * 1000LL + spec.tv_nsec / 1000000;
+    long long coarse = current_timestamp_ms();
+    assert_true(coarse <= real && real - coarse < 1000, "Coarse time should trail the system clock");
+    usleep(20000);
+    assert_true(current_timestamp_ms() > coarse, "Ticker should refresh the coarse time");
+
+    timesource_use_real();
+    assert_true(timesource_get_kind() == TIMESOURCE_REAL, "Real clock should be restored");
+}
+
+static int count_undelivered_between(int first, int last) {
+    int ids[16];
+    int cursor = first, count = 0, n;
+    while ((n = store_next_undelivered(&cursor, ids, 16)) > 0) {
+        for (int i = 0; i < n; i++) {
+            if (ids[i] <= last) count++;
+        }
+        if (ids[n - 1] > last) break;
+    }
+    return count;
+}
+
+void test_delivery_bitmap() {
+    // Initialize cache
+    memset(cache_hash_table, 0, sizeof(cache_hash_table));
+    lru_cache.head = NULL;
+    lru_cache.tail = NULL;
+    cache_count = 0;
+    for (int i = 0; i < 200; i++) {
+        t_message* msg = create_msg(14000 + i, "Sender", "DeliveryReceiver", "Pending", i % 10 == 0, MESSAGE_SIZE);
+        store_insert(msg);
+        free(msg);
+    }
+    assert_true(count_undelivered_between(14000, 14199) == 180, "Every message not delivered on insert should be pending");
+    t_msg_query query = { NULL, "DeliveryReceiver", 0 };
+    int* ids = NULL;
+    assert_true(msg_index_query(&query, &ids) == 180, "Index should list every pending message");
+    free(ids);
+
+    t_message_status* cached = retrieve_msg(14005, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    int batch[] = { 14001, 14003, 14005, 14010, 99999 };
+    assert_true(mark_delivered(batch, 5, cache_hash_table, HASH_TABLE_SIZE) == 3, "Only pending live messages should be newly marked");
+    assert_true(mark_delivered(batch, 3, cache_hash_table, HASH_TABLE_SIZE) == 0, "Marking twice should change nothing");
+    assert_true(cached_in_table(14005) && cache_hash_table[14005 % HASH_TABLE_SIZE]->message_with_status.message.delivered == 1, "Cached copy should be marked too");
+    free(cached);
+
+    // Records are not rewritten, yet reads and the secondary index see the new state
+    t_message msg;
+    assert_true(store_get(14003, &msg) == 1 && msg.delivered == 1, "Disk read should reflect the bitmap");
+    assert_true(msg_index_query(&query, &ids) == 177, "Index should no longer list marked messages as pending");
+    free(ids);
+    assert_true(count_undelivered_between(14000, 14199) == 177, "Marked messages should leave the pending scan");
+
+    // The bitmap is persisted, and deletions leave it
+    store_delete(14002);
+    store_close();
+    assert_true(store_open(TEST_STORE_FILE) == 0, "Failed to reopen the message store");
+    assert_true(store_get(14001, &msg) == 1 && msg.delivered == 1, "Marks should survive reopening the store");
+    assert_true(count_undelivered_between(14000, 14199) == 176, "Deleted message should not be pending");
+
+    // Ids past the bitmap keep their flag in the record, and are still found and marked
+    long pending = store_count_undelivered();
+    t_message* far = create_msg(100000000, "Sender", "DeliveryReceiver", "Far", 0, MESSAGE_SIZE);
+    assert_true(store_insert(far) == 1, "Failed to store a message past the bitmap");
+    free(far);
+    assert_true(store_count_undelivered() == pending + 1, "Untracked message should be counted as pending");
+    assert_true(count_undelivered_between(100000000, 100000000) == 1, "Untracked message should be found by the pending scan");
+    int far_id = 100000000;
+    int result;
+    assert_true(store_mark_delivered(&far_id, 1, &result) == 1 && result == 1, "Untracked message should be marked");
+    assert_true(store_get(far_id, &msg) == 1 && msg.delivered == 1, "Untracked mark should be kept in the record");
+    assert_true(store_count_undelivered() == pending && count_undelivered_between(100000000, 100000000) == 0, "Marked untracked message should leave the pending scan");
+
+    // Untracked ids stay in order through deletes and reopening, and page like the bitmap
+    for (int id = 100000003; id > 100000000; id--) {
+        far = create_msg(id, "Sender", "DeliveryReceiver", "Far", 0, MESSAGE_SIZE);
+        store_insert(far);
+        free(far);
+    }
+    store_delete(100000002);
+    store_close();
+    assert_true(store_open(TEST_STORE_FILE) == 0, "Failed to reopen the message store");
+    assert_true(store_count_undelivered() == pending + 2, "Untracked messages should be counted after reopening");
+    int cursor = 100000000;
+    int page[1];
+    assert_true(store_next_undelivered(&cursor, page, 1) == 1 && page[0] == 100000001, "First untracked message missing from the pending scan");
+    assert_true(store_next_undelivered(&cursor, page, 1) == 1 && page[0] == 100000003, "Deleted untracked message still pending");
+    assert_true(store_next_undelivered(&cursor, page, 1) == 0 && cursor == INT_MAX, "Pending scan should end after the untracked messages");
+}
+
+void test_background_eviction() {
+    // Initialize cache
+    memset(cache_hash_table, 0, sizeof(cache_hash_table));
+    lru_cache.head = NULL;
+    lru_cache.tail = NULL;
+    cache_count = 0;
+    cache_resize(64, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+    assert_true(cache_start_evictor(4, 16, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU) == 0, "Failed to start the evictor");
+    assert_true(cache_start_evictor(4, 16, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU) == -1, "Evictor should not start twice");
+
+    for (int i = 0; i < 200; i++) {
+        t_message* msg = create_msg(15000 + i, "Sender", "Receiver", "Evicted", 0, MESSAGE_SIZE);
+        cache_msg(msg, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+        free(msg);
+    }
+
+    // Once stores stop, the evictor leaves at least the low watermark of free slots
+    t_evictor_stats stats;
+    for (int wait = 0; wait < 200; wait++) {
+        cache_get_evictor_stats(&stats);
+        if (200 - (stats.background_evictions + stats.inline_evictions) <= 60) break;
+        usleep(10000);
+    }
+    assert_true(stats.background_evictions > 0 && stats.spare_entries > 0 && stats.spare_entries <= 16, "Evicted entries should be kept for reuse");
+
+    // Stop the evictor before looking at the cache structures it shares
+    cache_stop_evictor();
+    cache_get_evictor_stats(&stats);
+    assert_true(cache_count <= 60 && cache_count == 200 - (stats.background_evictions + stats.inline_evictions), "Evictor should keep 4 slots free");
+
+    // The most recent messages stayed, and the table and LRU list agree
+    int in_table = 0, in_list = 0;
+    for (int i = 0; i < HASH_TABLE_SIZE; i++) {
+        for (t_cache_hash_entry* entry = cache_hash_table[i]; entry; entry = entry->next) in_table++;
+    }
+    for (t_lru_node* node = lru_cache.head; node; node = node->next) in_list++;
+    assert_true(in_table == cache_count && in_list == cache_count, "Cache structures should stay consistent");
+    assert_true(cached_in_table(15199) && !cached_in_table(15100), "Least recently used messages should go first");
+
+    cache_resize(CACHE_SIZE, cache_hash_table, HASH_TABLE_SIZE, &lru_cache, &cache_count, LRU);
+}
@@ -1,6 +1,7 @@
 #include "message.h"
 #include "cache.h"
 #include "utility.h"
+#include "timesource.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -50,10 +51,12 @@ int main(int argc, char *argv[]) {
         cache_hash_table[i] = NULL;
     }
 
+    // Simulated time: each timestamp read is one millisecond after the last, so no sleeping is needed
+    timesource_use_virtual(TIMESOURCE_SIMULATION_START_MS, 1);
+
     // Generating and storing messages
     printf("Generating and Storing 20 Messages...\n");
     for (int i = 0; i < 20; i++) {
-        usleep(1000);
         char* content = generate_random_number_string(); // Generate a random string of 10 digits
         t_message* msg = create_msg(i, "Sender", "Receiver", content, 0, CONTEXT_SIZE);
         if (msg) {
@@ -75,6 +78,7 @@ int main(int argc, char *argv[]) {
         } else {
             printf("Message ID %d Not Found in Cache.\n", i);
         }
+        free(r_msg);
     }
 
     // Cache hit and miss statistics
@@ -86,13 +90,13 @@ int main(int argc, char *argv[]) {
 
     printf("Simulating 1000 Random Cache Accesses...\n");
     for (int i = 0; i < 1000; i++) {
-        usleep(1000);
         t_message_status* status = retrieve_msg(test_set[i], cache_hash_table, CACHE_SIZE, &lru_cache, &cache_count, replacement_strategy);
         if (status && status->hit_status == 1) {
             hits++;
         } else {
             misses++;
         }
+        free(status);
     }
 
     printf("%s Strategy - Hits: %d, Misses: %d, Hit Rate: %.2f%%\n", 
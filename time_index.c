@@ -0,0 +1,391 @@
+#include "time_index.h"
+#include "message.h"
+#include "msg_scan.h"
+#include "utility.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#define TIME_INDEX_MAGIC "TIDX"
+#define TIME_INDEX_VERSION 2
+#define TIME_INDEX_TAIL_BYTES 64
+#define TIME_INDEX_SYNC_BLOCKS 256 // appends persist the index once per this many new blocks
+#define RECORD_LINE_SIZE 2048
+
+/**
+ * @brief header of the time index file, followed by block_count t_time_block entries
+ */
+typedef struct t_time_index_header {
+    char magic[4];
+    int version;
+    int block_records;
+    int block_count;
+    long covered_size; // bytes of the message file described by the index
+    unsigned int tail_crc; // checksum of the last bytes it covers, to notice a replaced file
+    long long last_ts;
+    int monotone; // 1 if time_sent never decreases along the file
+} t_time_index_header;
+
+static char store_file[PATH_MAX];
+static char index_file[PATH_MAX + sizeof(TIME_INDEX_SUFFIX)];
+static t_time_block *blocks = NULL;
+static int block_count = 0;
+static int block_cap = 0;
+static long covered_size = 0;
+static long long last_ts = LLONG_MIN;
+static bool monotone = true;
+static bool loaded = false;
+static int synced_block_count = 0; // blocks in the index file as last written
+
+
+/**
+ * Adds one record to the in-memory index.
+ *
+ * @param time_sent The timestamp of the record.
+ * @param offset The byte offset of the record in the message file.
+ * @return 1 if the record started a new block, 0 if it joined the last block, -1 on failure.
+ */
+static int add_record(long long time_sent, long offset) {
+    if (time_sent < last_ts) {
+        monotone = false;
+    }
+    last_ts = time_sent;
+
+    if (block_count > 0 && blocks[block_count - 1].count < TIME_INDEX_BLOCK_RECORDS) {
+        t_time_block *block = &blocks[block_count - 1];
+        if (time_sent < block->min_ts) block->min_ts = time_sent;
+        if (time_sent > block->max_ts) block->max_ts = time_sent;
+        block->count++;
+        return 0;
+    }
+
+    if (block_count == block_cap) {
+        int new_cap = block_cap ? block_cap * 2 : 64;
+        t_time_block *new_blocks = (t_time_block *)realloc(blocks, new_cap * sizeof(t_time_block));
+        if (!new_blocks) {
+            fprintf(stderr, "Error: Memory allocation failed for time index.\n");
+            return -1;
+        }
+        blocks = new_blocks;
+        block_cap = new_cap;
+    }
+    blocks[block_count++] = (t_time_block){ .first_ts = time_sent, .min_ts = time_sent, .max_ts = time_sent, .offset = offset, .count = 1 };
+    return 1;
+}
+
+/**
+ * Indexes every complete record of the message file from a given offset on.
+ *
+ * @param from Byte offset to start reading from (must be the start of a record).
+ * @return 0 on success, -1 if the message file could not be read.
+ */
+static int index_from(long from) {
+    FILE *file = fopen(store_file, "r");
+    if (!file) {
+        return -1;
+    }
+    if (fseek(file, from, SEEK_SET) != 0) {
+        fclose(file);
+        return -1;
+    }
+
+    char line[RECORD_LINE_SIZE];
+    int id;
+    long time_sent;
+    long offset = from;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size_t len = strlen(line);
+        if (len == 0 || line[len - 1] != '\n') {
+            break; // partially written record, leave it for the next catch up
+        }
+        if (scan_msg_header(line, line + len, &id, &time_sent)) {
+            add_record(time_sent, offset);
+        }
+        offset += (long)len;
+        covered_size = offset;
+    }
+    fclose(file);
+    return 0;
+}
+
+/**
+ * Checksums the last bytes of the message file covered by the index.
+ *
+ * @param covered Number of bytes covered.
+ * @return The CRC-32 of up to TIME_INDEX_TAIL_BYTES bytes ending at covered, or 0 if they cannot be read.
+ */
+static unsigned int tail_checksum(long covered) {
+    char buf[TIME_INDEX_TAIL_BYTES];
+    long length = covered < TIME_INDEX_TAIL_BYTES ? covered : TIME_INDEX_TAIL_BYTES;
+    if (length == 0) {
+        return 0;
+    }
+    FILE *file = fopen(store_file, "rb");
+    if (!file) {
+        return 0;
+    }
+    int ok = fseek(file, covered - length, SEEK_SET) == 0 && fread(buf, 1, length, file) == (size_t)length;
+    fclose(file);
+    return ok ? checksum_crc32(buf, length) : 0;
+}
+
+/**
+ * Reads the persisted index, if it is present and matches the message file.
+ *
+ * @param store_size Current size of the message file.
+ * @return 1 if the index was loaded, 0 if it is missing or stale.
+ */
+static int load_index_file(long store_size) {
+    FILE *file = fopen(index_file, "rb");
+    if (!file) {
+        return 0;
+    }
+
+    t_time_index_header header;
+    int ok = fread(&header, sizeof(header), 1, file) == 1
+        && memcmp(header.magic, TIME_INDEX_MAGIC, 4) == 0
+        && header.version == TIME_INDEX_VERSION
+        && header.block_records == TIME_INDEX_BLOCK_RECORDS
+        && header.block_count >= 0
+        && header.covered_size <= store_size
+        && header.tail_crc == tail_checksum(header.covered_size);
+
+    if (ok && header.block_count > 0) {
+        blocks = (t_time_block *)malloc(header.block_count * sizeof(t_time_block));
+        ok = blocks && fread(blocks, sizeof(t_time_block), header.block_count, file) == (size_t)header.block_count;
+    }
+    fclose(file);
+
+    if (!ok) {
+        free(blocks);
+        blocks = NULL;
+        return 0;
+    }
+    block_count = block_cap = synced_block_count = header.block_count;
+    covered_size = header.covered_size;
+    last_ts = header.last_ts;
+    monotone = header.monotone;
+    return 1;
+}
+
+/**
+ * Opens the time index of a message file, loading the persisted index when it
+ * is up to date, indexing any records appended since it was written, and
+ * rebuilding it from scratch when it is missing or stale.
+ *
+ * @param store_path Path to the message file.
+ * @return 0 on success, -1 on failure.
+ */
+int time_index_open(const char *store_path) {
+    time_index_close();
+    snprintf(store_file, sizeof(store_file), "%s", store_path);
+    snprintf(index_file, sizeof(index_file), "%s%s", store_path, TIME_INDEX_SUFFIX);
+    loaded = true;
+
+    struct stat st;
+    long store_size = stat(store_file, &st) == 0 ? (long)st.st_size : 0;
+    if (!load_index_file(store_size)) {
+        return time_index_rebuild();
+    }
+    if (covered_size < store_size) {
+        index_from(covered_size);
+        time_index_sync();
+    }
+    return 0;
+}
+
+/**
+ * Records a message that was just appended to the message file.
+ * Does nothing until the index has been opened. The index file is only
+ * rewritten every TIME_INDEX_SYNC_BLOCKS new blocks; whatever it misses is
+ * indexed again from the message file when it is next opened.
+ *
+ * @param msg Pointer to the appended message.
+ * @param offset Byte offset the record was written at.
+ * @param end_offset Byte offset just past the end of the record.
+ */
+void time_index_append(const t_message *msg, long offset, long end_offset) {
+    if (!loaded || !msg) return;
+
+    if (offset != covered_size) {
+        // Someone else appended to the file, catch up from where we stopped
+        index_from(covered_size);
+        return;
+    }
+    int new_block = add_record(msg->time_sent, offset);
+    covered_size = end_offset;
+    if (new_block == 1 && block_count - synced_block_count >= TIME_INDEX_SYNC_BLOCKS) {
+        time_index_sync();
+    }
+}
+
+/**
+ * Streams every message with time_sent in [t_start, t_end], in file order.
+ * Blocks whose time range does not overlap the query are skipped; while the
+ * file is in time order, the first block is found by binary search and the
+ * scan stops at the first record past t_end.
+ *
+ * @param t_start Start of the time range (inclusive).
+ * @param t_end End of the time range (inclusive).
+ * @param visitor Function called for each matching message, with its byte offset in the file.
+ * @param arg Argument passed through to the visitor.
+ * @return The number of messages visited, or -1 on failure.
+ */
+int time_index_scan(long long t_start, long long t_end, t_msg_record_visitor visitor, void *arg) {
+    if (!loaded && time_index_open(MESSAGE_STORE_FILE) != 0) {
+        return -1;
+    }
+    struct stat st;
+    if (stat(store_file, &st) == 0 && (long)st.st_size > covered_size) {
+        index_from(covered_size);
+    }
+    if (block_count == 0 || t_start > t_end) {
+        return 0;
+    }
+
+    int first = 0;
+    if (monotone) {
+        // first block that may hold a record >= t_start
+        int lo = 0, hi = block_count;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (blocks[mid].max_ts < t_start) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        first = lo;
+    }
+
+    FILE *file = fopen(store_file, "r");
+    if (!file) {
+        return -1;
+    }
+
+    int visited = 0;
+    char line[RECORD_LINE_SIZE];
+    t_message msg;
+    bool done = false;
+    for (int b = first; b < block_count && !done; b++) {
+        if (blocks[b].min_ts > t_end) {
+            if (monotone) break;
+            continue;
+        }
+        if (blocks[b].max_ts < t_start) {
+            continue;
+        }
+
+        long end = (b + 1 < block_count) ? blocks[b + 1].offset : covered_size;
+        if (fseek(file, blocks[b].offset, SEEK_SET) != 0) {
+            break;
+        }
+        long offset = blocks[b].offset;
+        while (offset < end && fgets(line, sizeof(line), file) != NULL) {
+            long record_offset = offset;
+            size_t len = strlen(line);
+            offset += (long)len;
+            // Only records inside the range are parsed in full
+            int id;
+            long time_sent;
+            if (!scan_msg_header(line, line + len, &id, &time_sent)) continue;
+            if (time_sent > t_end && monotone) {
+                done = true;
+                break;
+            }
+            if (time_sent >= t_start && time_sent <= t_end && scan_msg_line(line, line + len, &msg)) {
+                visitor(&msg, record_offset, arg);
+                visited++;
+            }
+        }
+    }
+    fclose(file);
+    return visited;
+}
+
+/**
+ * Rebuilds the index from scratch by scanning the whole message file.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int time_index_rebuild(void) {
+    free(blocks);
+    blocks = NULL;
+    block_count = block_cap = synced_block_count = 0;
+    covered_size = 0;
+    last_ts = LLONG_MIN;
+    monotone = true;
+
+    index_from(0);
+    return time_index_sync();
+}
+
+/**
+ * Tells whether the index has been opened.
+ *
+ * @return 1 if the index is open, 0 otherwise.
+ */
+int time_index_is_open(void) {
+    return loaded;
+}
+
+/**
+ * Writes the index next to the message file, replacing the old one atomically.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int time_index_sync(void) {
+    if (!loaded) return 0;
+
+    char tmp_file[sizeof(index_file) + 4];
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", index_file);
+    FILE *file = fopen(tmp_file, "wb");
+    if (!file) {
+        fprintf(stderr, "Error: Unable to open file %s for writing.\n", tmp_file);
+        return -1;
+    }
+
+    t_time_index_header header = {
+        .version = TIME_INDEX_VERSION,
+        .block_records = TIME_INDEX_BLOCK_RECORDS,
+        .block_count = block_count,
+        .covered_size = covered_size,
+        .tail_crc = tail_checksum(covered_size),
+        .last_ts = last_ts,
+        .monotone = monotone,
+    };
+    memcpy(header.magic, TIME_INDEX_MAGIC, sizeof(header.magic));
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1
+        && (block_count == 0 || fwrite(blocks, sizeof(t_time_block), block_count, file) == (size_t)block_count);
+    if (fclose(file) != 0) ok = 0;
+
+    if (!ok || rename(tmp_file, index_file) != 0) {
+        fprintf(stderr, "Error: Unable to write time index %s.\n", index_file);
+        remove(tmp_file);
+        return -1;
+    }
+    synced_block_count = block_count;
+    return 0;
+}
+
+/**
+ * Persists and releases the in-memory index.
+ */
+void time_index_close(void) {
+    if (loaded) {
+        time_index_sync();
+    }
+    free(blocks);
+    blocks = NULL;
+    block_count = block_cap = 0;
+    covered_size = 0;
+    last_ts = LLONG_MIN;
+    monotone = true;
+    loaded = false;
+    synced_block_count = 0;
+}
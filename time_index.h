@@ -0,0 +1,30 @@
+#ifndef TIME_INDEX_H
+#define TIME_INDEX_H
+
+#include "message.h"
+
+#define TIME_INDEX_BLOCK_RECORDS 64
+#define TIME_INDEX_SUFFIX ".tidx"
+
+/**
+ * @brief one sparse index entry, describing a block of TIME_INDEX_BLOCK_RECORDS consecutive records
+ */
+typedef struct t_time_block {
+    long long first_ts; // time_sent of the first record in the block
+    long long min_ts;
+    long long max_ts;
+    long offset; // byte offset of the first record in the message file
+    int count; // number of records in the block
+} t_time_block;
+
+typedef void (*t_msg_record_visitor)(const t_message *msg, long offset, void *arg);
+
+int time_index_open(const char *store_path);
+void time_index_append(const t_message *msg, long offset, long end_offset);
+int time_index_scan(long long t_start, long long t_end, t_msg_record_visitor visitor, void *arg);
+int time_index_rebuild(void);
+int time_index_is_open(void);
+int time_index_sync(void);
+void time_index_close(void);
+
+#endif // TIME_INDEX_H
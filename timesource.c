@@ -0,0 +1,149 @@
+#include "timesource.h"
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+static int kind = TIMESOURCE_REAL;
+static t_timesource_fn custom_now = NULL;
+static long long now_ms = 0; // the coarse or virtual time, read without a lock
+static long long virtual_step_ms = 0;
+
+static pthread_mutex_t ticker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ticker_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t ticker_thread;
+static bool ticker_running = false;
+static bool ticker_stop = false;
+static int ticker_interval_ms = TIMESOURCE_DEFAULT_TICK_MS;
+
+
+static long long real_now_ms(void) {
+    struct timespec spec;
+    clock_gettime(CLOCK_REALTIME, &spec);
+    return spec.tv_sec * 1000LL + spec.tv_nsec / 1000000; // Convert to milliseconds
+}
+
+/**
+ * Reads the current time from whichever source is in use.
+ *
+ * @return Milliseconds since the Unix epoch, or since the virtual start.
+ */
+long long timesource_now_ms(void) {
+    switch (__atomic_load_n(&kind, __ATOMIC_ACQUIRE)) {
+    case TIMESOURCE_COARSE:
+        return __atomic_load_n(&now_ms, __ATOMIC_RELAXED);
+    case TIMESOURCE_VIRTUAL:
+        // Each read moves time on by the step, so successive reads stay distinct
+        return __atomic_fetch_add(&now_ms, __atomic_load_n(&virtual_step_ms, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    case TIMESOURCE_CUSTOM:
+        return custom_now();
+    default:
+        return real_now_ms();
+    }
+}
+
+int timesource_get_kind(void) {
+    return __atomic_load_n(&kind, __ATOMIC_ACQUIRE);
+}
+
+static void *ticker_main(void *arg) {
+    pthread_mutex_lock(&ticker_lock);
+    while (!ticker_stop) {
+        __atomic_store_n(&now_ms, real_now_ms(), __ATOMIC_RELAXED);
+        struct timespec wake;
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += ticker_interval_ms * 1000000L;
+        wake.tv_sec += wake.tv_nsec / 1000000000L;
+        wake.tv_nsec %= 1000000000L;
+        int rc = 0;
+        while (!ticker_stop && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&ticker_cond, &ticker_lock, &wake);
+        }
+    }
+    pthread_mutex_unlock(&ticker_lock);
+    return NULL;
+}
+
+static void stop_ticker(void) {
+    pthread_mutex_lock(&ticker_lock);
+    if (!ticker_running) {
+        pthread_mutex_unlock(&ticker_lock);
+        return;
+    }
+    ticker_stop = true;
+    pthread_cond_signal(&ticker_cond);
+    pthread_mutex_unlock(&ticker_lock);
+    pthread_join(ticker_thread, NULL);
+    ticker_running = false;
+}
+
+/**
+ * Reads the system clock on every call. This is the default.
+ */
+void timesource_use_real(void) {
+    stop_ticker();
+    __atomic_store_n(&kind, TIMESOURCE_REAL, __ATOMIC_RELEASE);
+}
+
+/**
+ * Reads a cached time that a ticker thread refreshes every tick_ms, so a
+ * read costs one load. Timestamps are then only as precise as the tick.
+ *
+ * @param tick_ms Milliseconds between two refreshes.
+ * @return 0 on success, -1 if the ticker could not be started.
+ */
+int timesource_use_coarse(int tick_ms) {
+    stop_ticker();
+    ticker_interval_ms = tick_ms > 0 ? tick_ms : TIMESOURCE_DEFAULT_TICK_MS;
+    ticker_stop = false;
+    __atomic_store_n(&now_ms, real_now_ms(), __ATOMIC_RELAXED);
+    if (pthread_create(&ticker_thread, NULL, ticker_main, NULL) != 0) {
+        fprintf(stderr, "Error: Unable to start the clock ticker.\n");
+        __atomic_store_n(&kind, TIMESOURCE_REAL, __ATOMIC_RELEASE);
+        return -1;
+    }
+    ticker_running = true;
+    __atomic_store_n(&kind, TIMESOURCE_COARSE, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Replaces the system clock with a virtual one, so runs are reproducible and
+ * never wait. Time starts at start_ms and moves on by step_ms at every read,
+ * and by timesource_advance.
+ *
+ * @param start_ms The first time read.
+ * @param step_ms How far each read moves time on, 0 to move it only by hand.
+ */
+void timesource_use_virtual(long long start_ms, long long step_ms) {
+    stop_ticker();
+    __atomic_store_n(&now_ms, start_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&virtual_step_ms, step_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&kind, TIMESOURCE_VIRTUAL, __ATOMIC_RELEASE);
+}
+
+/**
+ * Reads the time from a function supplied by the caller.
+ *
+ * @param now Returns the current time in milliseconds.
+ */
+void timesource_use_custom(t_timesource_fn now) {
+    if (!now) return;
+    stop_ticker();
+    custom_now = now;
+    __atomic_store_n(&kind, TIMESOURCE_CUSTOM, __ATOMIC_RELEASE);
+}
+
+/**
+ * Moves virtual time on, as a simulation's stand-in for sleeping.
+ * Has no effect on the other sources.
+ *
+ * @param ms Milliseconds to move on.
+ */
+void timesource_advance(long long ms) {
+    if (timesource_get_kind() == TIMESOURCE_VIRTUAL) __atomic_fetch_add(&now_ms, ms, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,24 @@
+#ifndef TIMESOURCE_H
+#define TIMESOURCE_H
+
+#define TIMESOURCE_REAL 0 // clock_gettime on every read
+#define TIMESOURCE_COARSE 1 // a value refreshed by a ticker thread
+#define TIMESOURCE_VIRTUAL 2 // advanced only by the program, for simulations
+#define TIMESOURCE_CUSTOM 3
+
+#define TIMESOURCE_DEFAULT_TICK_MS 1
+#define TIMESOURCE_SIMULATION_START_MS 1700000000000LL // where simulations start virtual time, so every run prints the same timestamps
+
+typedef long long (*t_timesource_fn)(void);
+
+long long timesource_now_ms(void);
+int timesource_get_kind(void);
+
+void timesource_use_real(void);
+int timesource_use_coarse(int tick_ms);
+void timesource_use_virtual(long long start_ms, long long step_ms);
+void timesource_use_custom(t_timesource_fn now);
+
+void timesource_advance(long long ms);
+
+#endif // TIMESOURCE_H
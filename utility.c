@@ -1,20 +1,20 @@
 #include "utility.h"
+#include "timesource.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
 #include <limits.h>
+#include <pthread.h>
 
 /**
- * Gets the current time in milliseconds.
+ * Gets the current time in milliseconds, from the time source in use (see timesource.c).
  * 
  * @return The current time in milliseconds since the Unix epoch.
  */
 long long current_timestamp_ms() {
-    struct timespec spec;
-    clock_gettime(CLOCK_REALTIME, &spec);
-    return spec.tv_sec * 1000LL + spec.tv_nsec / 1000000; // Convert to milliseconds
+    return timesource_now_ms();
 }
 
 /**
@@ -43,3 +43,35 @@ char* generate_random_number_string() {
 
     return random_number_string;
 }
+
+
+static unsigned int crc32_table[256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+static void init_crc32_table(void) {
+    for (unsigned int i = 0; i < 256; i++) {
+        unsigned int crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320u : crc >> 1;
+        }
+        crc32_table[i] = crc;
+    }
+}
+
+/**
+ * Computes the CRC-32 (IEEE 802.3) checksum of a buffer.
+ * 
+ * @param data Pointer to the bytes to checksum.
+ * @param length Number of bytes.
+ * @return The checksum.
+ */
+unsigned int checksum_crc32(const void* data, unsigned long length) {
+    pthread_once(&crc32_once, init_crc32_table);
+
+    const unsigned char* bytes = (const unsigned char*)data;
+    unsigned int crc = 0xFFFFFFFFu;
+    for (unsigned long i = 0; i < length; i++) {
+        crc = crc32_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
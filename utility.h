@@ -3,5 +3,6 @@
 
 long long current_timestamp_ms();
 char* generate_random_number_string();
+unsigned int checksum_crc32(const void* data, unsigned long length);
 
 #endif // UTILITY_H